@@ -36,8 +36,30 @@
 // if true, the condition is reset after executing the last segment
 #define RESET_CONDITION 0
 
-// the maximum # of entities allowed in
-#define MAX_CROWDING 5
+// the cadence of each latitude band (see Agent::updateCadenceBand())
+struct CadenceBand {
+	int cadence;
+	int period;
+};
+
+static struct CadenceBands {
+	CadenceBand band[NUM_CADENCE_BANDS];
+	
+	CadenceBands() {
+		for (int percentExecuting = 0; percentExecuting <= 100; percentExecuting++) {
+			if (percentExecuting > 50) {
+				band[percentExecuting].cadence = eSkipEvery;
+				band[percentExecuting].period = (percentExecuting + percentExecuting - 80) / 10;
+			}
+			else {
+				band[percentExecuting].cadence = eExecuteEvery;
+				band[percentExecuting].period = (120 - percentExecuting - percentExecuting) / 10;
+			}
+		}
+		band[UNTHROTTLED_BAND].cadence = eExecuteAlways;
+		band[UNTHROTTLED_BAND].period = 1;
+	}
+} sCadenceBands;
 
 // experimental, agents have two different condition flags, one for odd and one for even segments
 #define USE_TWO_CONDITIONS 0
@@ -49,25 +71,19 @@ Agent::Agent()
 
 void Agent::initialize(Vector3 pt, const char * pGenome, bool allowMutation)
 {
-	mNumSegments = mGenome.initialize(pGenome);
-	mNumMoveSegments = mNumMoveAndEatSegments = 0;
-	for (int i = 0; i < mNumSegments; i++)
-	{
-		switch (mGenome.getInstruction(i)) {
-			default: break;
-				
-			case eInstructionMove:
-				++mNumMoveSegments;
-				break;
-				
-			case eInstructionMoveAndEat:
-				++mNumMoveAndEatSegments;
-				break;
-		}
-	}
-	
-	if (mNumSegments == 0)
+	if (*pGenome == 0)
 		throw "error";
+	
+	// the genome has been decoded already if any agent in the world has it
+	SphereWorld *pWorld = getWorld();
+	const GenomeProgram & program = pWorld->setAgentGenome(mIndex, pGenome);
+	mGenome = program.genome;
+	
+	// (before mNumSegments changes, as any segments the agent has are let go of by their number)
+	pWorld->allocateSegments(mIndex, program.numSegments);
+	mNumSegments = program.numSegments;
+	mNumMoveSegments = program.numMoveSegments;
+	mNumMoveAndEatSegments = program.numMoveAndEatSegments;
 	computeSpawnEnergy();
 	
 	// life, energy etc
@@ -80,12 +96,13 @@ void Agent::initialize(Vector3 pt, const char * pGenome, bool allowMutation)
 	if (allowMutation)
 		setAllowMutate();
 	mSpawnLocation = pt;
+	updateCadenceBand();
 	// establish initial move vector
 	float moveDistance = Parameters::instance.getCellSize();
 	
-	mMoveVector.x = (float(rand()) / float(RAND_MAX)) * moveDistance;
-	mMoveVector.y = (float(rand()) / float(RAND_MAX)) * moveDistance;
-	mMoveVector.z = (float(rand()) / float(RAND_MAX)) * moveDistance;
+	mMoveVector.x = (float(UtilsRandom::getRandom()) / float(RAND_MAX)) * moveDistance;
+	mMoveVector.y = (float(UtilsRandom::getRandom()) / float(RAND_MAX)) * moveDistance;
+	mMoveVector.z = (float(UtilsRandom::getRandom()) / float(RAND_MAX)) * moveDistance;
 	
 	Vector3 newLocation = pt + mMoveVector;
 	newLocation.normalize();
@@ -106,37 +123,38 @@ void Agent::initialize(Vector3 pt, const char * pGenome, bool allowMutation)
 	float scaleLocation = 1;
 	int i = 0;
 	
-	mNumOccludedPhotosynthesize = mNumNonOccludedPhotosynthesize = 0;
+	// all segments are initially occluded in the case of a critters with multiple segments,
+	// where the segments are initially overlapping.
+	bool isOccluded = (mNumSegments > 1);
+	mNumOccludedPhotosynthesize = isOccluded ? program.numPhotosynthesizeSegments : 0;
+	mNumNonOccludedPhotosynthesize = isOccluded ? 0 : program.numPhotosynthesizeSegments;
+	if (program.isMotile)
+		setIsMotile();
 	
 	while (i < mNumSegments)
 	{
 		SphereEntity &segment = mSegments[i];
 		
-		segment.mType = (*pGenome) & eInstructionMask;
-		++pGenome;
-		if (segment.mType == eInstructionMove || segment.mType == eInstructionMoveAndEat)
-			setIsMotile();
-		
+		segment.mType = program.instruction[i];
 		segment.mSegmentIndex = i;
 		segment.mLocation = pt * scaleLocation;
 		segment.mAgent = this;
-		
-		// all segments are initially occluded in the case of a critters with multiple segments,
-		// where the segments are initially overlapping.
-		segment.mIsOccluded = (mNumSegments > 1);
-		if (segment.mType == eInstructionPhotosynthesize) {
-			if (segment.mIsOccluded) {
-				++mNumOccludedPhotosynthesize;
-			}
-			else {
-				++mNumNonOccludedPhotosynthesize;
-			}
-		}
+		segment.mIsOccluded = isOccluded;
 		++i;
 	}
 	turn(UtilsRandom::getRangeRandom(0, 359));
 }
 
+SphereWorld * Agent :: getWorld()
+{
+	return mSegments->mWorld;
+}
+
+int Agent :: getSpecies()
+{
+	return getWorld()->getSpecies(mIndex);
+}
+
 void Agent :: computeSpawnEnergy()
 {
 	float moveMult = 0;//.1f;
@@ -146,6 +164,183 @@ void Agent :: computeSpawnEnergy()
 	Parameters::instance.extraSpawnEnergyPerSegment;
 }
 
+/**
+ Close to the poles, an agent only executes on some of its turns, depending on how close
+ its spawn location is. This puts it in the band for that, which has to be done whenever
+ mSpawnLocation changes
+ **/
+void Agent :: updateCadenceBand()
+{
+	float poleDistance = mSpawnLocation.y*mSpawnLocation.y;
+	if (poleDistance > .5f) {
+		
+		// from 100% to 10%
+		int percentExecuting = (int) (100 - (poleDistance - .5f) * 195);
+		mCadenceBand = max(0, min(100, percentExecuting));
+	}
+	else
+		mCadenceBand = UNTHROTTLED_BAND;
+}
+
+/**
+ Returns the eCadence of the agent's band, and the period that goes with it
+ **/
+int Agent :: getCadence(int &period)
+{
+	const CadenceBand & band = sCadenceBands.band[mCadenceBand];
+	period = band.period;
+	return band.cadence;
+}
+
+/**
+ The number of turns from 1 to turn (inclusive) that the agent executes on
+ **/
+int Agent :: countExecutingTurns(int turn)
+{
+	int period;
+	switch (getCadence(period)) {
+		case eSkipEvery:
+			return turn - turn / period;
+		case eExecuteEvery:
+			return turn / period;
+		default:
+			return turn;
+	}
+}
+
+/**
+ The n'th turn (counting from 1) that the agent executes on
+ **/
+int Agent :: findExecutingTurn(int n)
+{
+	int period;
+	switch (getCadence(period)) {
+		case eSkipEvery:
+			return n + (n - 1) / (period - 1);
+		case eExecuteEvery:
+			return n * period;
+		default:
+			return n;
+	}
+}
+
+/**
+ The energy that the agent's photosynthesize segments give it every step, whatever it does
+ **/
+float Agent :: getPhotosynthesisGain(float photoBonus)
+{
+	return ((float)mNumNonOccludedPhotosynthesize - (float)mNumOccludedPhotosynthesize/2.0f) * photoBonus;
+}
+
+/**
+ Executes a photosynthesize segment
+ **/
+void Agent :: photosynthesize(int segment)
+{
+	if (! mSegments[segment].mIsOccluded) {
+		mEnergy += Parameters::instance.getPhotosynthesizeBonus();
+	}
+}
+
+/**
+ Called once the last segment has executed, to go back to the first, and spawn if the agent can
+ **/
+void Agent :: finishCycle(SphereWorld *pWorld, float cycleEnergyCost)
+{
+	if (mSegments[0].mIsOccluded) {
+		this->mEnergy -= cycleEnergyCost * 2;
+	}
+	
+	mActiveSegment = 0;
+	clearIsHyper();
+	clearIsAnchored();
+	
+#if RESET_CONDITION
+	clearCondition();
+#endif
+	spawnIfAble(pWorld);
+}
+
+/**
+ The agent's energy after a step spent sleeping, starting from the given energy
+ **/
+float Agent :: getEnergyAfterSleeping(float energy, float photosynthesizeBonus)
+{
+	float cycleEnergyCost = CYCLE_ENERGY_COST;
+	energy += getPhotosynthesisGain(photosynthesizeBonus - 1.0f);
+	return energy - cycleEnergyCost/3;
+}
+
+/**
+ What step() does on a turn that isn't hyper and that the agent sleeps through and lives through:
+ it ages, sleeps, and then is dormant for a few turns unless the world is running flat out
+ **/
+void Agent :: takeSleepingStep(int speed, float photosynthesizeBonus)
+{
+	--mLifespan;
+	if (mDelaySpawnCount)
+		--mDelaySpawnCount;
+	mEnergy = getEnergyAfterSleeping(mEnergy, photosynthesizeBonus);
+	--mSleep;
+	if (speed < 10)
+		mDormant += HYPER_NUM_STEPS-1;
+}
+
+/**
+ The number of steps until the next one that does more than count mDormant down (the one
+ that brings it to 0 can end the agent's sleep) or sleep, or that the agent executes on at all.
+ Not for an agent with mDormant < 0, which is dormant for good
+ **/
+int Agent :: getTurnsUntilAwake(int speed, float photosynthesizeBonus)
+{
+	int numSteps = mDormant > 0 ? mDormant : 1;
+
+	// a sleeping agent is idle until its sleep and the dormant turns after it are over, unless it dies of age
+	// or runs out of energy first. Its steps are followed here just as skipIdleTurns() will take them
+	if (mSleep > 0 && mDormant >= 0 && ! getIsHyper()) {
+		int dormant = mDormant;
+		int sleep = mSleep;
+		int lifespan = mLifespan;
+		float energy = mEnergy;
+		numSteps = 1;
+		while (true) {
+			numSteps += dormant;
+			dormant = 0;
+			if (sleep == 0 || lifespan <= 1 || energy < 0)
+				break;
+			
+			--lifespan;
+			energy = getEnergyAfterSleeping(energy, photosynthesizeBonus);
+			--sleep;
+			++numSteps;
+			if (speed < 10)
+				dormant = HYPER_NUM_STEPS-1;
+		}
+	}
+	return findExecutingTurn(countExecutingTurns(mTurn) + numSteps) - mTurn;
+}
+
+/**
+ Does what that many steps would do to an agent that they are all idle for (see
+ getTurnsUntilAwake())
+ **/
+void Agent :: skipIdleTurns(int numTurns, int speed, float photosynthesizeBonus)
+{
+	int numSteps = countExecutingTurns(mTurn + numTurns) - countExecutingTurns(mTurn);
+	while (numSteps > 0 && (mDormant > 0 || (mDormant == 0 && mSleep > 0))) {
+		if (mDormant > 0) {
+			int n = min(mDormant, numSteps);
+			mDormant -= n;
+			numSteps -= n;
+		}
+		else {
+			takeSleepingStep(speed, photosynthesizeBonus);
+			--numSteps;
+		}
+	}
+	mTurn += numTurns;
+}
+
 /**
  Process the Agent's active segment
  **/
@@ -160,33 +355,28 @@ void Agent::step(SphereWorld * pWorld)
 	if (mStatus != eAlive)
 		return;
 	
+	const GenomeProgram & program = pWorld->getProgram(mIndex);
+	
 	// if close to tjhe poles, slow it down
 	++mTurn;
-	float poleDistance = mSpawnLocation.y*mSpawnLocation.y;
-	if (poleDistance > .5f) {
-		
-		// from 100% to 10%
-		int percentExecuting = (int) (100 - (poleDistance - .5f) * 195);
-		
-		if (percentExecuting > 50) {
-			
-			int dontExecute = (percentExecuting + percentExecuting - 80) / 10;
-			if ((mTurn % dontExecute) == 0)
-				return;
-		}
-		else {
-			int doExecute = (120 - percentExecuting - percentExecuting) / 10;
-			
-			if ((mTurn % doExecute) != 0)
-				return;
-		}
+	int period;
+	int cadence = getCadence(period);
+	if (cadence == eSkipEvery) {
+		if ((mTurn % period) == 0)
+			return;
+	}
+	else if (cadence == eExecuteEvery) {
+		if ((mTurn % period) != 0)
+			return;
 	}
 	
 	if (mDormant) {
 		if (mDormant > 0)
 			--mDormant;
-		if (mDormant == 0 && mSleep == -1)
+		if (mDormant == 0 && mSleep == -1) {
 			mSleep = 0;
+			pWorld->updateSpeciesCount(mIndex);
+		}
 		return;
 	}
 	
@@ -219,30 +409,40 @@ void Agent::step(SphereWorld * pWorld)
 	
 	float photoBonus = (Parameters::instance.getPhotosynthesizeBonus() - 1.0f);
 	
+	// most of the agents in a mature world are lone photosynthesize segments, which there's
+	// nothing to interpret for. This is the one pass the loop below would make for one, without
+	// decoding the segment
+	if (!isHyper && mSleep == 0 && program.isPlant) {
+		mEnergy += getPhotosynthesisGain(photoBonus);
+		mEnergy -= cycleEnergyCost;
+		photosynthesize(0);
+		finishCycle(pWorld, cycleEnergyCost);
+		numSteps = 0;
+	}
+	
 	for (int step = 1; step <= numSteps; step++)
 	{
 		if (mStatus != eAlive)
 			break;
 		
-		mEnergy += ((float)mNumNonOccludedPhotosynthesize - (float)mNumOccludedPhotosynthesize/2.0f) * photoBonus;
+		if (mSleep > 0)
+		{
+			mEnergy = getEnergyAfterSleeping(mEnergy, Parameters::instance.getPhotosynthesizeBonus());
+			--mSleep;
+			continue;
+		}
+		
+		mEnergy += getPhotosynthesisGain(photoBonus);
 		
 		if (mSleep)
 		{
-			if (mSleep > 0)
-			{
-				mEnergy -= cycleEnergyCost/3;
-				--mSleep;
-				continue;
-			}
-			else {
-				// send me off to sleep forever more...
-				return;
-			}
+			// send me off to sleep forever more...
+			return;
 		}
 		
 		// now process the active segment
-		char instruction = mGenome.getInstruction(mActiveSegment);
-		eSegmentExecutionType executeType = mGenome.getExecType(mActiveSegment);
+		char instruction = program.instruction[mActiveSegment];
+		eSegmentExecutionType executeType = (eSegmentExecutionType) program.execType[mActiveSegment];
 		
 		bool isOr = false;//(executeType == eAlways) && Parameters::instance.allowOr;
 		
@@ -371,9 +571,7 @@ void Agent::step(SphereWorld * pWorld)
 					break; }
 					
 				case eInstructionPhotosynthesize:
-					if (! mSegments[mActiveSegment].mIsOccluded) {
-						mEnergy += Parameters::instance.getPhotosynthesizeBonus();
-					}
+					photosynthesize(mActiveSegment);
 					++numSteps;
 					break;
 					
@@ -404,19 +602,7 @@ void Agent::step(SphereWorld * pWorld)
 		}
 
 		if (++mActiveSegment >= mNumSegments) {
-			
-			if (mSegments[0].mIsOccluded) {
-				this->mEnergy -= cycleEnergyCost * 2;
-			}
-			
-			mActiveSegment = 0;
-			clearIsHyper();
-			clearIsAnchored();
-			
-#if RESET_CONDITION
-			clearCondition();
-#endif
-			spawnIfAble(pWorld);
+			finishCycle(pWorld, cycleEnergyCost);
 			break;
 		}
 	}
@@ -448,9 +634,7 @@ void Agent :: die(SphereWorld *pWorld, bool andBecomeFood)
 			pWorld->addFood(foodPoints[i]);
 			
 			float distance = Parameters::instance.getCellSize() / 2;
-			SphereEntityPtr entities[5];
-			int nearbyResults = pWorld->getNearbyEntities(foodPoints[i], distance, entities, sizeof(entities)/sizeof(entities[0]));
-			if (nearbyResults > 0)
+			if (pWorld->anyWithin(foodPoints[i], distance))
 				continue;
 			
 			Agent *pNewAgent = pWorld->createEmptyAgent();
@@ -472,7 +656,7 @@ bool Agent::canEat(Agent * rhs)
 	if (rhs->mStatus != eAlive || rhs->getWasEaten())\
 		return false;
 	
-	if (! Parameters::instance.cannibals && mGenome == rhs->mGenome)
+	if (! Parameters::instance.cannibals && getSpecies() == rhs->getSpecies())
 		return false;
 	
     if (rhs->mSegments[0].mScale != 1.0f)
@@ -620,6 +804,8 @@ void Agent::move(SphereWorld * pWorld, bool andEat)
 				// we moved onto a photosynthesize segment through a move and eat instruction, so chomp!
 				if (! ate) // only gain the energy from one eating per turn
 				{
+					// (if it's parked, it might be asleep, so its energy is brought up to date first)
+					pWorld->wakeAgent(pAgent->mIndex);
 					float energyLoss = min(Parameters::instance.extraSpawnEnergyPerSegment * biteStrength, pAgent->mEnergy+1);
 					if (pAgent->getIsAnchored()) {
 						energyLoss /= 2;
@@ -633,6 +819,7 @@ void Agent::move(SphereWorld * pWorld, bool andEat)
 					pAgent->setWasPreyedOn();
 					if (pAgent->mEnergy <= 0) {
 						pAgent->setWasEaten();
+						pWorld->wakeAgent(pAgent->mIndex);
 					}
 				}
 				ate = true;
@@ -752,8 +939,7 @@ void Agent::move(SphereWorld * pWorld, bool andEat)
 		// segment on top of it
 		if (Parameters::instance.allowSelfOverlap && mSegments[i].mType == eInstructionPhotosynthesize && ! mSegments[i].mIsOccluded)
 		{
-			int numEntities = pWorld->getNearbyEntities(&mSegments[i], cellSize / 2, entities);
-			if (numEntities) {
+			if (pWorld->anyWithin(mSegments[i].mLocation, cellSize / 2, this)) {
 				mSegments[i].mIsOccluded = true;
 				if (mSegments[i].mType == eInstructionPhotosynthesize)
 				{
@@ -772,6 +958,7 @@ void Agent::move(SphereWorld * pWorld, bool andEat)
 		mSpawnLocation.y += spawnLocationOffset.y / 10.0f;
 		mSpawnLocation.z += spawnLocationOffset.z / 10.0f;
 		mSpawnLocation.normalize();
+		updateCadenceBand();
 	}
 	
 }
@@ -810,13 +997,13 @@ void Agent::orientTowardsPole()
 	mMoveVector = dif;
 }
 
-// Test if we're facing food in the direction that the head is pointing.
-// This returns true if we find either a Photosynthesize segment or a FakePhotosynthesize segment
-// in the direct line of sight.
-bool Agent::testIsFacingFood(SphereWorld *pWorld, float distMultiplier)
+// Works out the locations (and the radius around each) that the vision instructions search, stepping
+// along a great circle in the direction that the head is pointing. Returns the number of steps.
+int Agent::getLookPath(float distMultiplier, Vector3 *pLocations, float *pRadii)
 {
 	float lookspread = Parameters::instance.lookSpread;
 	int visionDistance = Parameters::instance.lookDistance * distMultiplier;
+	visionDistance = min(visionDistance, (int) MAX_LOOK_DISTANCE);
 	
 	Vector3 lookLocation = mSegments[0].mLocation;
 	Vector3 lookVector = mMoveVector;
@@ -833,43 +1020,8 @@ bool Agent::testIsFacingFood(SphereWorld *pWorld, float distMultiplier)
 		lookVector.normalize();
 		lookVector *= lookDistance;
 		
-		SphereEntityPtr entities[16];
-		int numEntities = pWorld->getNearbyEntities(lookLocation, lookRadius, entities);
-		
-		if (numEntities > 0)
-		{
-			bool isBlocked = false;
-			for (int j = 0; j < numEntities; j++)
-			{
-				SphereEntity *pEntity = entities[j];
-				Agent *pAgent = pEntity->mAgent;
-				
-				// check that the agent is alive, since we might have killed while looping over entities
-				if (pAgent && pAgent->mStatus != eNonExistent)
-				{
-					switch (pEntity->mType)
-					{
-						case eInstructionPhotosynthesize:
-							if (canEat(pAgent))
-								return true;
-							break;
-							
-						default:
-							if (pAgent == this) {
-								if (pEntity != &pAgent->mSegments[0]) {
-									isBlocked = true;
-								}
-							}
-							else {
-								isBlocked = true;
-							}
-						break;
-					}
-				}
-			}
-			if (isBlocked)
-				return false;
-		}
+		pLocations[i] = lookLocation;
+		pRadii[i] = lookRadius;
 		
 		if (i > 3) {
 			lookDistance *= lookspread;
@@ -877,75 +1029,53 @@ bool Agent::testIsFacingFood(SphereWorld *pWorld, float distMultiplier)
 		}
 	}
 	
-	return false;
+	return visionDistance;
 }
 
-bool Agent::testIsFacing(SphereWorld *pWorld, float distMultiplier, facingFunction func)
+// We see food if it's a Photosynthesize segment or a FakePhotosynthesize segment that we can eat.
+// Anything else blocks the line of sight, except for our own head.
+eFacing Agent::facingFoodFunction(Agent *pAgent, SphereEntity *pEntity)
 {
-	float lookspread = Parameters::instance.lookSpread;
-	int visionDistance = Parameters::instance.lookDistance * distMultiplier;
-	
-	Vector3 lookLocation = mSegments[0].mLocation;
-	Vector3 lookVector = mMoveVector;
-	float lookDistance = lookVector.length();
-	
-	float lookRadius = Parameters::instance.getCellSize();// * Parameters::instance.mouthSize;
-	
-	for (int i = 0; i < visionDistance; i++)
-	{
-		Vector3 oldLocation = lookLocation;
-		lookLocation = oldLocation + lookVector;
-		lookLocation.normalize();
-		lookVector = lookLocation - oldLocation;
-		lookVector.normalize();
-		lookVector *= lookDistance;
-		
-		SphereEntityPtr entities[16];
-		int numEntities = pWorld->getNearbyEntities(lookLocation, lookRadius, entities);
-		
-		if (numEntities > 0)
-		{
-			bool isBlocked = false;
-			for (int j = 0; j < numEntities; j++)
-			{
-				SphereEntity *pEntity = entities[j];
-				Agent *pAgent = pEntity->mAgent;
-				
-				// check that the agent is alive, since we might have killed while looping over entities
-				if (pAgent && pAgent->mStatus != eNonExistent)
-				{
-					switch (func(pAgent, pEntity)) {
-						case eFacingTrue:
-							return true;
-						case eFacingFalse:
-							isBlocked = true;
-							break;
-						case eFacingIgnore:
-							break;
-					}
-				}
-			}
-				
-			if (isBlocked)
-				return false;
-		}
-		
-		if (i > 3) {
-			lookDistance *= lookspread;
-			lookRadius *= lookspread;
-		}
+	if (pEntity->mType == eInstructionPhotosynthesize) {
+		return pAgent->canEat(pEntity->mAgent) ? eFacingTrue : eFacingIgnore;
+	}
+	if (pEntity == &pAgent->mSegments[0]) {
+		return eFacingIgnore;
 	}
+	return eFacingFalse;
+}
+
+// Test if we're facing food in the direction that the head is pointing.
+// This returns true if we find either a Photosynthesize segment or a FakePhotosynthesize segment
+// in the direct line of sight.
+bool Agent::testIsFacingFood(SphereWorld *pWorld, float distMultiplier)
+{
+	// only food can make the answer true, so there's no need to look past the last food along the way
+	return testIsFacing(pWorld, distMultiplier, facingFoodFunction, ENTITY_KIND_BIT(eEntityFood));
+}
+
+// Test what we're facing in the direction that the head is pointing. func is called with this agent
+// and each entity along the line of sight, and the first entity it doesn't ignore decides the result.
+// targetKinds are the kinds of entity that func can return eFacingTrue for.
+bool Agent::testIsFacing(SphereWorld *pWorld, float distMultiplier, facingFunction func, unsigned targetKinds)
+{
+	Vector3 lookLocations[MAX_LOOK_DISTANCE];
+	float lookRadii[MAX_LOOK_DISTANCE];
+	int numSteps = getLookPath(distMultiplier, lookLocations, lookRadii);
 	
-	return false;
+	return pWorld->lookAlongPath(lookLocations, lookRadii, numSteps, this, func, targetKinds);
 }
 
 
-static eFacing facingSiblingFunction(Agent *pAgent, SphereEntity *pEntity)
+// (this compares the agent seen with itself, as it did when testIsFacing called it with the agent seen
+// rather than the one looking, so it ignores everything and a sibling is never seen)
+static eFacing facingSiblingFunction(Agent *pLooker, SphereEntity *pEntity)
 {
+	Agent *pAgent = pEntity->mAgent;
 	if (pAgent == pEntity->mAgent) {
 		return eFacingIgnore;
 	}
-	if (pAgent->mGenome == pEntity->mAgent->mGenome) {
+	if (pAgent->getSpecies() == pEntity->mAgent->getSpecies()) {
 		return eFacingTrue;
 	}
 	return eFacingFalse;
@@ -953,7 +1083,7 @@ static eFacing facingSiblingFunction(Agent *pAgent, SphereEntity *pEntity)
 
 bool Agent :: testIsFacingSibling(SphereWorld *pWorld, float distMultiplier)
 {
-	return testIsFacing(pWorld, distMultiplier, facingSiblingFunction);
+	return testIsFacing(pWorld, distMultiplier, facingSiblingFunction, ALL_ENTITY_KINDS);
 }
 
 void Agent::sleep()
@@ -1007,12 +1137,15 @@ void Agent::spawnIfAble(SphereWorld * pWorld)
 	}
 	
 	
-	int numEntities = pWorld->getNearbyEntities(ptLocation, spawnSpread, entities, sizeof(entities)/sizeof(entities[0]), this);
+	// usually a count is all that's needed; only gather the neighbors when it's crowded
+	int numEntities = pWorld->countWithin(ptLocation, spawnSpread, MAX_CROWDING + 1, this);
 	if (numEntities > MAX_CROWDING) {
+		numEntities = pWorld->getNearbyEntities(ptLocation, spawnSpread, entities, sizeof(entities)/sizeof(entities[0]), this);
 		if (getIsMotile()) {
 			std::set<Agent*> agents;
 			for (int i = 0; i < numEntities; i++) {
 				Agent * pAgent = entities[i]->mAgent;
+				pWorld->catchUpAgent(pAgent->mIndex);
 				if (pAgent->mStatus == eAlive && getIsMotile() == pAgent->getIsMotile() &&
 					(pAgent->mNumSegments > 1 || !pAgent->mDormant)) {
 					agents.insert(entities[i]->mAgent);
@@ -1039,8 +1172,9 @@ void Agent::spawnIfAble(SphereWorld * pWorld)
 		pInstructions = mutantGenome;
 	}
 	
-	Agent *pNewAgent = pWorld->createEmptyAgent();
-	if (pNewAgent != NULL && pInstructions[0] != 0)
+	// (a slot that is taken has to be used, so don't ask for one for an empty genome)
+	Agent *pNewAgent = pInstructions[0] != 0 ? pWorld->createEmptyAgent() : NULL;
+	if (pNewAgent != NULL)
 	{
 		pNewAgent->initialize(ptLocation, pInstructions, getAllowMutate());
 		// split the energy with the offspring
@@ -1054,19 +1188,17 @@ void Agent::spawnIfAble(SphereWorld * pWorld)
 			pNewAgent->mSleep += Parameters::instance.sleepTimeAfterBeingSpawned;
 		}
 		
-		string parentGenome(mParentGenome);
-		if (parentGenome.length() == 0) {
-			parentGenome = mGenome;
-		}
-		string newGenome(pNewAgent->mGenome);
+		int parentSpecies = mParentGenome[0] ? pWorld->internSpecies(mParentGenome) : getSpecies();
 		
-		if (parentGenome != newGenome) {
-			pWorld->registerMutation(pNewAgent->mGenome, parentGenome.c_str());
+		if (parentSpecies != pNewAgent->getSpecies()) {
+			pWorld->registerMutation(pNewAgent->getSpecies(), parentSpecies);
 			pNewAgent->mParentGenome = mGenome;
-			parentGenome = pNewAgent->mParentGenome;
 		}
 		else {
 			pNewAgent->mParentGenome = this->mParentGenome;
 		}
+		
+		// (the parent genome's species may have been added just now, and not been put in the family tree)
+		pWorld->removeSpeciesIfUnused(parentSpecies);
 	}
 }
\ No newline at end of file
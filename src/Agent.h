@@ -42,12 +42,28 @@ enum {
 class SphereEntity;
 class Agent;
 
+// how often an agent executes, which is less often close to the poles
+enum eCadence {
+	eExecuteAlways,
+	eSkipEvery,		// executes except on every period'th turn
+	eExecuteEvery	// executes only on every period'th turn
+};
+
+// the latitude bands that agents are grouped into by cadence: one for each percentage of turns
+// executed near the poles, and one for everywhere else
+#define NUM_CADENCE_BANDS 102
+#define UNTHROTTLED_BAND 101
+
+// the maximum # of entities allowed in the spot where an agent spawns (see Agent::spawnIfAble())
+#define MAX_CROWDING 5
+
 enum eFacing {
 	eFacingTrue,
 	eFacingFalse,
 	eFacingIgnore
 };
 typedef eFacing (*facingFunction)(Agent *, SphereEntity *);
+typedef bool (*entityFilter)(Agent *, SphereEntity *);
 
 class SphereEntity;
 
@@ -70,10 +86,31 @@ public:
 	
     void spawnIfAble(SphereWorld * pWorld);
     float getSpawnEnergy() { return mSpawnEnergy; }
+
+	// the world that the agent's slot is in (which its segments know, as does the placeholder that an agent
+	// without any points to)
+	SphereWorld * getWorld();
+	int getSpecies();
+
+	// for skipping over the turns that an agent would do nothing on but count down or sleep, or be skipped near a
+	// pole. A sleeping step depends on the speed and the photosynthesize bonus, so those are passed in
+	int getTurnsUntilAwake(int speed, float photosynthesizeBonus);
+	void skipIdleTurns(int numTurns, int speed, float photosynthesizeBonus);
+	void updateCadenceBand();
 	
 private:
 	void computeSpawnEnergy();
-	bool testIsFacing(SphereWorld *pWorld, float distMultiplier, facingFunction func);
+	int getCadence(int &period);
+	int countExecutingTurns(int turn);
+	int findExecutingTurn(int n);
+	float getPhotosynthesisGain(float photoBonus);
+	void photosynthesize(int segment);
+	void finishCycle(SphereWorld *pWorld, float cycleEnergyCost);
+	float getEnergyAfterSleeping(float energy, float photosynthesizeBonus);
+	void takeSleepingStep(int speed, float photosynthesizeBonus);
+	bool testIsFacing(SphereWorld *pWorld, float distMultiplier, facingFunction func, unsigned targetKinds);
+	int getLookPath(float distMultiplier, Vector3 *pLocations, float *pRadii);
+	static eFacing facingFoodFunction(Agent *, SphereEntity *);
 	
 private:
 	bool canEat(Agent *);
@@ -96,7 +133,7 @@ public:
 	int		mDormant;
 	int		mDelaySpawnCount;
     Vector3 mSpawnLocation;
-    int     mSleepTimeAfterBeingSpawned;
+    int     mCadenceBand;   // (once an unused field, so it's worked out again when a world is loaded)
 
     // moving
     Vector3 mMoveVector;
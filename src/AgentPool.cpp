@@ -0,0 +1,47 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ AgentPool
+
+ The agents used to be a fixed array of MAX_AGENTS in the world, with MAX_SEGMENTS segments each,
+ which set both the most agents a world could have and the memory it took however few it had. Here
+ they are allocated in chunks as they're needed, and an agent is still found by its index. Their
+ segments are handed out separately, by size (see SegmentArena).
+ **/
+
+#include "AgentPool.h"
+
+AgentPool::AgentPool()
+{
+}
+
+AgentPool::~AgentPool()
+{
+    for (size_t i = 0; i < mChunks.size(); i++)
+        delete mChunks[i];
+}
+
+void AgentPool::grow(SphereEntity *pNoSegments)
+{
+    Chunk *pChunk = new Chunk();
+    for (int i = 0; i < AGENT_CHUNK_SIZE; i++)
+        pChunk->agents[i].mSegments = pNoSegments;
+    mChunks.push_back(pChunk);
+}
@@ -0,0 +1,51 @@
+//
+//  AgentPool.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_AgentPool_h
+#define MutationPlanet_AgentPool_h
+
+#include "Constants.h"
+#include "Agent.h"
+#include "SphereEntity.h"
+#include <vector>
+
+// the agents are allocated in chunks of this many
+#define AGENT_CHUNK_BITS 10
+#define AGENT_CHUNK_SIZE (1 << AGENT_CHUNK_BITS)
+
+/**
+ The agents of a world, allocated a chunk at a time as the population grows, so that the memory used
+ follows the number of agents rather than the most there could be. A chunk never moves once allocated,
+ so pointers to agents stay good as the pool grows. Their segments are in the world's SegmentArena
+ **/
+class AgentPool
+{
+public:
+    AgentPool();
+    ~AgentPool();
+
+    Agent & operator[](int index) { return mChunks[index >> AGENT_CHUNK_BITS]->agents[index & (AGENT_CHUNK_SIZE - 1)]; }
+
+    // agent indexes are all below this, which is always a whole number of chunks
+    int getCapacity() { return (int) mChunks.size() << AGENT_CHUNK_BITS; }
+
+    // adds a chunk of nonexistent agents, which have no segments but the world's placeholder (see
+    // SphereWorld::allocateSegments())
+    void grow(SphereEntity *pNoSegments);
+
+private:
+    struct Chunk {
+        Agent agents[AGENT_CHUNK_SIZE];
+    };
+
+    std::vector<Chunk*> mChunks;
+
+    // not copyable, as the chunks are owned
+    AgentPool(const AgentPool &);
+    AgentPool & operator=(const AgentPool &);
+};
+
+#endif
@@ -0,0 +1,145 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ AgentScheduler
+
+ Keeps track of the agents that have nothing to do until some later turn (mostly dead cells, which lie
+ dormant for thousands of turns), so that SphereWorld doesn't have to step them every turn to count down.
+
+ It is a hierarchical timer wheel. An agent due within WHEEL_SLOTS turns goes in the first level, in the
+ slot for its turn. One due later goes in the slot of a higher level that covers its turn, and when the
+ wheel reaches the start of that slot, the agents in it are moved down to the finer levels. Scheduling,
+ unscheduling and advancing a turn are all constant time, whatever the number of agents.
+ **/
+
+#include "AgentScheduler.h"
+
+AgentScheduler::AgentScheduler()
+{
+    clear(0);
+}
+
+void AgentScheduler::clear(long turn)
+{
+    for (int i = 0; i < NUM_LISTS; i++)
+        mHead[i] = -1;
+    mList.assign(mList.size(), NOT_SCHEDULED);
+    mTurn = turn;
+}
+
+void AgentScheduler::setCapacity(int numAgents)
+{
+    mNext.resize(numAgents, -1);
+    mPrev.resize(numAgents, -1);
+    mList.resize(numAgents, NOT_SCHEDULED);
+    mWakeTurn.resize(numAgents, 0);
+}
+
+void AgentScheduler::schedule(int index, long wakeTurn)
+{
+    unschedule(index);
+    mWakeTurn[index] = wakeTurn;
+    insert(index);
+}
+
+void AgentScheduler::scheduleForever(int index)
+{
+    unschedule(index);
+    link(index, FOREVER_LIST);
+}
+
+void AgentScheduler::unschedule(int index)
+{
+    int list = mList[index];
+    if (list == NOT_SCHEDULED)
+        return;
+
+    if (mPrev[index] == -1)
+        mHead[list] = mNext[index];
+    else
+        mNext[mPrev[index]] = mNext[index];
+    if (mNext[index] != -1)
+        mPrev[mNext[index]] = mPrev[index];
+    mList[index] = NOT_SCHEDULED;
+}
+
+/**
+ Puts the agent in the slot of the finest level that can hold its turn
+ **/
+void AgentScheduler::insert(int index)
+{
+    long wakeTurn = mWakeTurn[index];
+    long delta = wakeTurn - mTurn;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1L << (WHEEL_BITS * (level + 1))))
+        ++level;
+
+    // past the span of the wheel, wait in the last slot it reaches and be put back when that comes around
+    if (delta >= WHEEL_SPAN)
+        wakeTurn = mTurn + WHEEL_SPAN - 1;
+
+    int slot = (int) (wakeTurn >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    link(index, level * WHEEL_SLOTS + slot);
+}
+
+void AgentScheduler::link(int index, int list)
+{
+    mList[index] = list;
+    mPrev[index] = -1;
+    mNext[index] = mHead[list];
+    if (mHead[list] != -1)
+        mPrev[mHead[list]] = index;
+    mHead[list] = index;
+}
+
+/**
+ Empties a slot of a higher level, putting each of its agents where it now belongs
+ **/
+void AgentScheduler::cascade(int list)
+{
+    int index = mHead[list];
+    mHead[list] = -1;
+    while (index != -1) {
+        int next = mNext[index];
+        insert(index);
+        index = next;
+    }
+}
+
+void AgentScheduler::advance(std::vector<int> & due)
+{
+    ++mTurn;
+
+    // starting a slot of a higher level moves its agents down, coarsest first, so that an agent can drop
+    // through more than one level on the same turn
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        long mask = (1L << (WHEEL_BITS * level)) - 1;
+        if ((mTurn & mask) == 0)
+            cascade(level * WHEEL_SLOTS + (int) ((mTurn >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+    }
+
+    int list = (int) (mTurn & (WHEEL_SLOTS - 1));
+    for (int index = mHead[list]; index != -1; index = mNext[index]) {
+        mList[index] = NOT_SCHEDULED;
+        due.push_back(index);
+    }
+    mHead[list] = -1;
+}
@@ -0,0 +1,69 @@
+//
+//  AgentScheduler.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_AgentScheduler_h
+#define MutationPlanet_AgentScheduler_h
+
+#include "Constants.h"
+#include <vector>
+
+// the wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each. A slot on the first level covers one turn,
+// one on the second level covers WHEEL_SLOTS turns, and so on
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3
+
+// the furthest ahead that the wheel can tell turns apart; agents due later are kept in its last
+// slot and looked at again when it comes around
+#define WHEEL_SPAN (1L << (WHEEL_BITS * WHEEL_LEVELS))
+
+class AgentScheduler
+{
+public:
+    AgentScheduler();
+
+    // forgets every scheduled agent, and starts counting from the given turn
+    void clear(long turn);
+
+    // makes room for agent indexes below numAgents (which only ever grows)
+    void setCapacity(int numAgents);
+
+    // schedules the agent to be due on the given turn, which has to be after the current one
+    void schedule(int index, long wakeTurn);
+
+    // keeps the agent until it is unscheduled, however many turns go by
+    void scheduleForever(int index);
+
+    void unschedule(int index);
+    bool isScheduled(int index) { return mList[index] != NOT_SCHEDULED; }
+
+    // moves on to the next turn, and appends the agents that are due on it to due (unscheduling them)
+    void advance(std::vector<int> & due);
+
+    long getTurn() { return mTurn; }
+
+private:
+    enum {
+        NOT_SCHEDULED = -1,
+        FOREVER_LIST = WHEEL_LEVELS * WHEEL_SLOTS,
+        NUM_LISTS
+    };
+
+    void insert(int index);
+    void link(int index, int list);
+    void cascade(int list);
+
+    // each slot's agents are in a doubly linked list, threaded through arrays indexed by agent
+    int mHead[NUM_LISTS];
+    std::vector<int> mNext;
+    std::vector<int> mPrev;
+    std::vector<int> mList;
+    std::vector<long> mWakeTurn;
+
+    long mTurn;
+};
+
+#endif
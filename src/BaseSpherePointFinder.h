@@ -0,0 +1,202 @@
+//
+//  BaseSpherePointFinder.h
+//  MutationPlanet
+//
+//
+
+#ifndef __BioSphere__BaseSpherePointFinder__
+#define __BioSphere__BaseSpherePointFinder__
+
+#include "gameplay.h"
+#include "SphereEntity.h"
+#include "Agent.h"
+
+using namespace gameplay;
+
+/**
+ * How full a point finder's buckets are, to check that its resolution suits the population.
+ */
+struct PointFinderStats {
+    enum { NUM_HISTOGRAM_BUCKETS = 8 };
+
+    int numCells;
+    int numEntities;
+    int numOccupiedCells;
+    int maxOccupancy;
+
+    // the number of cells holding 0, 1, 2-3, 4-7, 8-15... entities; the last one also counts any fuller cells
+    int histogram[NUM_HISTOGRAM_BUCKETS];
+
+    // the totals of the per cell counts of each kind
+    int numByKind[eNumEntityKinds];
+
+    void reset(int cells) {
+        numCells = cells;
+        numEntities = numOccupiedCells = maxOccupancy = 0;
+        memset(histogram, 0, sizeof(histogram));
+        memset(numByKind, 0, sizeof(numByKind));
+    }
+
+    void addCell(int count) {
+        numEntities += count;
+        if (count > 0)
+            ++numOccupiedCells;
+        maxOccupancy = max(maxOccupancy, count);
+
+        int bucket = 0;
+        while (count > 0 && bucket < NUM_HISTOGRAM_BUCKETS - 1) {
+            ++bucket;
+            count >>= 1;
+        }
+        ++histogram[bucket];
+    }
+
+    void print() {
+        gameplay::print("%d entities in %d cells, %d occupied (%.1f per occupied cell, max %d)\n", numEntities, numCells,
+            numOccupiedCells, numOccupiedCells ? float(numEntities) / numOccupiedCells : 0.0f, maxOccupancy);
+        gameplay::print("cells by occupancy: 0: %d, 1: %d, 2-3: %d, 4-7: %d, 8-15: %d, 16-31: %d, 32-63: %d, 64+: %d\n",
+            histogram[0], histogram[1], histogram[2], histogram[3], histogram[4], histogram[5], histogram[6], histogram[7]);
+        gameplay::print("food: %d, barrier: %d, motile: %d\n", numByKind[eEntityFood], numByKind[eEntityBarrier], numByKind[eEntityMotile]);
+    }
+};
+
+/**
+ * The k nearest entities found so far by a findNearest() search, kept sorted by distance in the caller's array.
+ * The distances aren't stored, since they are cheap to work out again.
+ */
+struct NearestEntities {
+    const Vector3 & pt;
+    SphereEntity ** pResults;
+    int k;
+    int count;
+
+    // the distance an entity has to be within to make the list: maxDistance until there are k of them, and
+    // then that of the k-th nearest
+    float bound;
+
+    NearestEntities(const Vector3 & point, SphereEntity ** pResultArray, int maxResults, float maxDistance)
+        : pt(point), pResults(pResultArray), k(maxResults), count(0), bound(maxDistance) {}
+
+    bool isFull() { return count >= k; }
+
+    void add(SphereEntity * pEntity, float d) {
+        if (d > bound || (count == k && d == bound))
+            return;
+        if (count == k)
+            --count;
+
+        int i = count++;
+        while (i > 0 && calcDistance(pt, pResults[i - 1]->mLocation) > d) {
+            pResults[i] = pResults[i - 1];
+            --i;
+        }
+        pResults[i] = pEntity;
+
+        if (count == k)
+            bound = calcDistance(pt, pResults[k - 1]->mLocation);
+    }
+};
+
+/**
+ * Whether an entity passes the filters of a findNearest() search
+ */
+inline bool passesFilter(SphereEntity * pEntity, unsigned kindMask, Agent * pAgent, entityFilter filter) {
+    return (kindMask & ENTITY_KIND_BIT(getEntityKind(pEntity->mType))) && (pAgent == NULL || pEntity->mAgent != pAgent) &&
+        (filter == NULL || filter(pAgent, pEntity));
+}
+
+/**
+ * The interface shared by the different methods of finding entities on the sphere, so that
+ * the world can switch between them at runtime and compare their performance.
+ */
+class BaseSpherePointFinder {
+public:
+    virtual ~BaseSpherePointFinder() {}
+
+    virtual void clear() = 0;
+    virtual void insert(SphereEntity *) = 0;
+    virtual void remove(SphereEntity *) = 0;
+    virtual void moveEntity(SphereEntity *, Vector3) = 0;
+
+    // lets a finder that can change its resolution pick one to suit the size of most queries
+    virtual void setCellSize(float /*cellSize*/) {}
+    virtual void getStats(PointFinderStats & stats) = 0;
+
+    virtual int getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults = 16, Agent *pExclude = NULL) = 0;
+
+    int getNearbyEntities(SphereEntity * pNearEntity, float distance, SphereEntity **pResultArray, int maxResults = 16) {
+        return getNearbyEntities(pNearEntity->mLocation, distance, pResultArray, maxResults, pNearEntity->mAgent);
+    }
+
+    // counts the entities within distance of the point, stopping once there are limit of them. Unlike
+    // getNearbyEntities, this never gathers the entities themselves, so it can skip empty buckets cheaply
+    virtual int countWithin(const Vector3 &pt, float distance, int limit, Agent *pExclude = NULL) = 0;
+
+    bool anyWithin(const Vector3 &pt, float distance, Agent *pExclude = NULL) {
+        return countWithin(pt, distance, 1, pExclude) > 0;
+    }
+
+    // returns the ENTITY_KIND_BITs of the kinds held by any bucket that the search cube overlaps, out of those in
+    // kindMask. This only reads the per bucket counts, so a set bit means an entity of that kind may be in range,
+    // and a clear one that none is. It stops looking once it has found every kind in kindMask
+    virtual unsigned getKindsNear(const Vector3 &pt, float distance, unsigned kindMask = ALL_ENTITY_KINDS) = 0;
+
+    /**
+     * Finds the k entities nearest to the point (by calcDistance), up to maxDistance away, and puts them in pResultArray
+     * nearest first. Unlike getNearbyEntities, which stops at whichever entities it comes to first, this is exact.
+     * Only entities of the kinds in kindMask count, and those of pAgent are skipped; if filter isn't NULL, it is called
+     * with pAgent and each entity, and only those it returns true for count. Returns the number found.
+     */
+    virtual int findNearest(const Vector3 &pt, int k, SphereEntity **pResultArray, float maxDistance = 2, unsigned kindMask = ANY_ENTITY_KIND,
+                            Agent *pAgent = NULL, entityFilter filter = NULL) = 0;
+
+    /**
+     * Looks along a path of search cubes (such as an agent's line of sight) for the first one holding an entity
+     * that func doesn't ignore, and returns true if func returns eFacingTrue for any entity in that cube.
+     * The steps are searched in order, so the search stops at the first one that decides the answer.
+     *
+     * If func can only return eFacingTrue for entities of some kinds, passing those as targetKinds lets the
+     * search end at the last step that might hold one of them, since nothing past it could make the answer true.
+     * That step is found from the far end, so when targets are common it usually takes a single check.
+     */
+    virtual bool lookAlongPath(const Vector3 *pLocations, const float *pRadii, int numSteps, Agent *pLooker, facingFunction func,
+                               unsigned targetKinds = ALL_ENTITY_KINDS) {
+        if (targetKinds != ALL_ENTITY_KINDS) {
+            while (numSteps > 0 && ! getKindsNear(pLocations[numSteps - 1], pRadii[numSteps - 1], targetKinds))
+                --numSteps;
+        }
+
+        for (int i = 0; i < numSteps; i++)
+        {
+            SphereEntityPtr entities[16];
+            int numEntities = getNearbyEntities(pLocations[i], pRadii[i], entities);
+
+            bool isBlocked = false;
+            for (int j = 0; j < numEntities; j++)
+            {
+                SphereEntity *pEntity = entities[j];
+                Agent *pAgent = pEntity->mAgent;
+
+                // check that the agent is alive, since we might have killed while looping over entities
+                if (pAgent && pAgent->mStatus != eNonExistent)
+                {
+                    switch (func(pLooker, pEntity)) {
+                        case eFacingTrue:
+                            return true;
+                        case eFacingFalse:
+                            isBlocked = true;
+                            break;
+                        case eFacingIgnore:
+                            break;
+                    }
+                }
+            }
+
+            if (isBlocked)
+                return false;
+        }
+        return false;
+    }
+};
+
+#endif /* defined(__BioSphere__BaseSpherePointFinder__) */
@@ -17,6 +17,8 @@ enum {
     TURN_ANGLE = 30,
     HARD_TURN_ANGLE = 90,
     NUM_SUBDIVISIONS = 64,
+    CUBE_FACE_SUBDIVISIONS = 20,
+    MAX_LOOK_DISTANCE = 100,
     
 	KILL_SEGMENT_THRESHHOLD = 25000,
 	MAX_TOTAL_SEGMENTS = 30000,
@@ -13,7 +13,7 @@ int Genome :: initialize(const char *pInstructions)
 
 static eSegmentExecutionType getRandomExecutionType()
 {
-	int r = rand() % 3;
+	int r = UtilsRandom::getRandom() % 3;
 	switch (r) {
 	case 0:
 		return eIf;
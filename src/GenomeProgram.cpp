@@ -0,0 +1,141 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ GenomeProgram
+
+ An agent's genome never changes, and most agents share theirs with many others, so rather than
+ decoding the genome's instructions every time an agent is born or steps, each distinct genome
+ is decoded once into a GenomeProgram, which the agents refer to by index.
+
+ The programs are found by species ID, and are reference counted by the agents using them, so
+ that the program of a genome that has died out can be reused.
+ **/
+
+#include "GenomeProgram.h"
+#include "InstructionSet.h"
+
+GenomePrograms::GenomePrograms()
+{
+    mNumAllocated = 0;
+    clear();
+}
+
+GenomePrograms::~GenomePrograms()
+{
+    for (size_t i = 0; i < mBlocks.size(); i++)
+        delete[] mBlocks[i];
+}
+
+/**
+ Forgets every program. The blocks are kept to be reused
+ **/
+void GenomePrograms::clear()
+{
+    mNumPrograms = 0;
+    mSpeciesProgram.clear();
+
+    mFreeHead = -1;
+    for (int i = mNumAllocated - 1; i >= 0; i--) {
+        get(i).next = mFreeHead;
+        get(i).refCount = 0;
+        mFreeHead = i;
+    }
+}
+
+int GenomePrograms::acquire(int species, const char *pGenome)
+{
+    if (species >= (int) mSpeciesProgram.size())
+        mSpeciesProgram.resize(species + 1, -1);
+    if (mSpeciesProgram[species] != -1) {
+        ++get(mSpeciesProgram[species]).refCount;
+        return mSpeciesProgram[species];
+    }
+
+    if (mFreeHead == -1) {
+        mBlocks.push_back(new GenomeProgram[PROGRAM_BLOCK_SIZE]);
+        for (int i = mNumAllocated + PROGRAM_BLOCK_SIZE - 1; i >= mNumAllocated; i--) {
+            get(i).next = mFreeHead;
+            get(i).refCount = 0;
+            mFreeHead = i;
+        }
+        mNumAllocated += PROGRAM_BLOCK_SIZE;
+    }
+
+    int result = mFreeHead;
+    GenomeProgram & program = get(result);
+    mFreeHead = program.next;
+
+    compile(program, pGenome);
+    program.species = species;
+    program.refCount = 1;
+    mSpeciesProgram[species] = result;
+    ++mNumPrograms;
+    return result;
+}
+
+void GenomePrograms::release(int index)
+{
+    GenomeProgram & program = get(index);
+    if (--program.refCount > 0)
+        return;
+
+    mSpeciesProgram[program.species] = -1;
+    program.next = mFreeHead;
+    mFreeHead = index;
+    --mNumPrograms;
+}
+
+/**
+ Decodes the genome's instructions, and works out what Agent::initialize() needs to know about it
+ **/
+void GenomePrograms::compile(GenomeProgram & program, const char *pGenome)
+{
+    program.numSegments = program.genome.initialize(pGenome);
+    program.numMoveSegments = program.numMoveAndEatSegments = program.numPhotosynthesizeSegments = 0;
+    program.isMotile = false;
+
+    for (int i = 0; i < program.numSegments; i++) {
+        char instruction = program.genome.getInstruction(i);
+        program.instruction[i] = instruction;
+        program.execType[i] = (unsigned char) program.genome.getExecType(i);
+
+        switch (instruction) {
+            default:
+                break;
+
+            case eInstructionMove:
+                ++program.numMoveSegments;
+                program.isMotile = true;
+                break;
+
+            case eInstructionMoveAndEat:
+                ++program.numMoveAndEatSegments;
+                program.isMotile = true;
+                break;
+
+            case eInstructionPhotosynthesize:
+                ++program.numPhotosynthesizeSegments;
+                break;
+        }
+    }
+
+    program.isPlant = program.numSegments == 1 && program.execType[0] == eAlways &&
+        program.instruction[0] == eInstructionPhotosynthesize;
+}
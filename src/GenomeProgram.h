@@ -0,0 +1,77 @@
+//
+//  GenomeProgram.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_GenomeProgram_h
+#define MutationPlanet_GenomeProgram_h
+
+#include "Constants.h"
+#include "Genome.h"
+#include <vector>
+
+// the programs are allocated in blocks of this many, so that they never move once compiled
+#define PROGRAM_BLOCK_BITS 8
+#define PROGRAM_BLOCK_SIZE (1 << PROGRAM_BLOCK_BITS)
+
+// a genome, decoded once for all of the agents that carry it
+struct GenomeProgram {
+    Genome genome;
+    int numSegments;
+    char instruction[MAX_GENOME_LENGTH];
+    unsigned char execType[MAX_GENOME_LENGTH];
+
+    // facts about the genome as a whole
+    int numMoveSegments;
+    int numMoveAndEatSegments;
+    int numPhotosynthesizeSegments;
+    bool isMotile;
+    bool isPlant;   // a lone, unconditional photosynthesize segment
+
+    // for GenomePrograms
+    int species;
+    int next;
+    int refCount;
+};
+
+/**
+ The programs of the genomes of the agents in a world, by species ID (see SpeciesTable), each compiled
+ the first time it is seen and shared until the last agent with it dies
+ **/
+class GenomePrograms
+{
+public:
+    GenomePrograms();
+    ~GenomePrograms();
+
+    void clear();
+
+    // returns the index of the species' program, compiling its genome if need be, and adds a reference to it
+    int acquire(int species, const char *pGenome);
+    void release(int program);
+
+    GenomeProgram & get(int program) { return mBlocks[program >> PROGRAM_BLOCK_BITS][program & (PROGRAM_BLOCK_SIZE - 1)]; }
+
+    // the number of programs in use
+    int getNumPrograms() { return mNumPrograms; }
+
+private:
+    void compile(GenomeProgram & program, const char *pGenome);
+
+    std::vector<GenomeProgram*> mBlocks;
+    int mNumAllocated;
+    int mNumPrograms;
+
+    // unused programs, linked through next
+    int mFreeHead;
+
+    // the program of each species, or -1
+    std::vector<int> mSpeciesProgram;
+
+    // not copyable, as the blocks are owned
+    GenomePrograms(const GenomePrograms &);
+    GenomePrograms & operator=(const GenomePrograms &);
+};
+
+#endif
@@ -41,6 +41,11 @@
     #define USE_ZYWEBVIEW
 #endif
 
+// the point finder checks, stats and benchmarks are only in debug builds (Visual Studio defines _DEBUG, Xcode DEBUG)
+#if defined(_DEBUG) || defined(DEBUG)
+    #define POINT_FINDER_DEBUG
+#endif
+
 #ifdef USE_ZYWEBVIEW
     #include "webview/ZYWebView.h"
     ZYWebView * pWebView = NULL;
@@ -51,7 +56,6 @@
 
 // Declare our game instance
 Main game;
-SphereWorld Main :: world;
 
 static int mFollowingIndex;
 float gTurnsPerSecond = 60;
@@ -124,17 +128,6 @@ Main::Main()
 	_formSaveLoad = NULL;
         
     memset(mSegmentBatch, 0, sizeof(mSegmentBatch));
-	
-    for (int i = 0; i < sizeof(world.mAgents)/sizeof(world.mAgents[0]); i++)
-    {
-        Agent * pAgent = &world.mAgents[i];
-        pAgent->mStatus = eNonExistent;
-        for (int j = 0; j < sizeof(pAgent->mSegments)/sizeof(pAgent->mSegments[0]); j++)
-        {
-            SphereEntity * pEntity = &pAgent->mSegments[j];
-            pEntity->mAgent = pAgent;
-        }
-    }
 }
 
 Vector3 getRandomSpherePoint();
@@ -190,23 +183,24 @@ void * Main :: threadFunction(void*)
 					int numTurnsSinceTally = (int)(numTurns - startSampleTurns);
 					startSampleTurns = numTurns;            
 					gTurnsPerSecond = ((float) numTurnsSinceTally) / ((float)elapsedTimeSinceTally) * 1000.f;
-					world.sampleTopSpecies();
+					game.world.sampleTopSpecies();
 
                     elapsedTimeSinceTally = 0;
 				}
 
 				elapsedTimeSinceTally += elapsedTicks;
 
-				int numSegments = world.step();
+				game.world.setMaxAgents(Parameters::instance.maxAgents);
+				int numSegments = game.world.step();
 				static int lastFollowing = -1;
-				mFollowingIndex = world.getTopCritterIndex();
+				mFollowingIndex = game.world.getTopCritterIndex();
 
 
-				if ((numSegments > KILL_SEGMENT_THRESHHOLD || gLastFPS < MIN_FPS) && (numSegments > MAX_TOTAL_SEGMENTS/5)) {
+				if ((numSegments > game.world.getKillSegmentThreshold() || gLastFPS < MIN_FPS) && (numSegments > game.world.getMaxTotalSegments()/5)) {
                     if (killMS == 0) {
                         killMS = curMS();
                     }
-                    world.killAtLeastNumSegments(numSegments * .75f, mFollowingIndex);
+                    game.world.killAtLeastNumSegments(numSegments * .75f, mFollowingIndex);
 				}
 			}
 
@@ -283,7 +277,9 @@ SegmentResourceMapping arraySegments[] =
  **/
 void Main::initialize()
 {
+#ifdef POINT_FINDER_DEBUG
 	world.test();
+#endif
 
 #ifndef _WINDOWS
     if (_height > _width) {
@@ -506,9 +502,10 @@ void Main :: setBarriers(int type, bool bOn)
     
     if (! bOn)
     {
-        // remove specified barrier type
-        for (int i = 0; i < world.mMaxLiveAgentIndex; i++)
+        // remove specified barrier type (going backwards, as killing an agent moves the last one into its place)
+        for (int n = world.getNumLiveAgents() - 1; n >= 0; n--)
         {
+            int i = world.getLiveAgentIndex(n);
             Agent & agent = world.mAgents[i];
             if ((agent.mStatus == eInanimate) && (agent.mSegments[0].mType == barrierType))
                 world.killAgent(i);
@@ -529,8 +526,7 @@ void Main :: setBarriers(int type, bool bOn)
                 Vector3 v(cos(a),sin(a*20)/10,sin(a));
                 v.normalize();
                 pAgent->initialize(v, genome.c_str(), true);
-                world.addAgentToWorld(pAgent);
-                pAgent->mStatus = eInanimate;
+                world.addAgentToWorld(pAgent, eInanimate);
                 pAgent->mEnergy = pAgent->getSpawnEnergy();
             }
         }
@@ -547,8 +543,7 @@ void Main :: setBarriers(int type, bool bOn)
 						continue;
                     Agent *pAgent = world.createEmptyAgent(true);
                     pAgent->initialize(v, genome.c_str(), true);
-                    world.addAgentToWorld(pAgent);
-                    pAgent->mStatus = eInanimate;
+                    world.addAgentToWorld(pAgent, eInanimate);
                     pAgent->mEnergy = pAgent->getSpawnEnergy();
 					}
 				}
@@ -590,8 +585,7 @@ void Main :: setBarriers(int type, bool bOn)
                     }
                     v.normalize();
                     pAgent->initialize(v, genome.c_str(), true);
-                    world.addAgentToWorld(pAgent);
-                    pAgent->mStatus = eInanimate;
+                    world.addAgentToWorld(pAgent, eInanimate);
                     pAgent->mEnergy = pAgent->getSpawnEnergy();
                 }
             }
@@ -607,8 +601,7 @@ void Main :: setBarriers(int type, bool bOn)
                 Vector3 v(cos(a),0,sin(a));
                 v.normalize();
                 pAgent->initialize(v, genome.c_str(), true);
-                world.addAgentToWorld(pAgent);
-                pAgent->mStatus = eInanimate;
+                world.addAgentToWorld(pAgent, eInanimate);
                 pAgent->mEnergy = pAgent->getSpawnEnergy();
             }
 		}
@@ -756,8 +749,9 @@ void Main::renderCritters(float elapsedTime) {
         if (pass == 2 && mViewScale < 1.5)
             break;
             
-        for (int i = 0; i <= world.mMaxLiveAgentIndex; i++)
+        for (int n = 0; n < world.getNumLiveAgents(); n++)
         {
+            int i = world.getLiveAgentIndex(n);
             Agent & agent = world.mAgents[i];
             if (agent.mStatus != eNonExistent)
             {                
@@ -1065,6 +1059,34 @@ void Main::keyEvent(Keyboard::KeyEvent evt, int key)
 				if (mViewScale < 1)
 					mViewScale = 1;
 				break;
+
+#ifdef POINT_FINDER_DEBUG
+			case Keyboard::KEY_F: {
+				// cycle through the point finders, to compare their turns per second
+				LockWorldMutex m;
+				world.setPointFinder((ePointFinder) ((world.getPointFinder() + 1) % eNumPointFinders));
+				print("using point finder %d\n", (int) world.getPointFinder());
+				break; }
+			case Keyboard::KEY_G: {
+				// report how evenly the entities are spread over the point finder's cells
+				LockWorldMutex m;
+				world.printPointFinderStats();
+				break; }
+			case Keyboard::KEY_B: {
+				// time the move and spawn query patterns against each point finder
+				LockWorldMutex m;
+				world.benchmarkPointFinders();
+				break; }
+			case Keyboard::KEY_T: {
+				// check the point finders against a brute force search, then time how they scale (which doesn't
+				// use the world, so it doesn't hold up the simulation)
+				{
+					LockWorldMutex m;
+					world.test();
+				}
+				world.benchmarkPointFinderScaling();
+				break; }
+#endif
         }
     }
 }
@@ -1128,7 +1150,7 @@ void Main::gesturePinchEvent(int x, int y, float scale)
 }
 
 const int FORM_HEIGHT_NO_ADVANCED = 326;
-const int FORM_HEIGHT_WITH_ADVANCED = 750;
+const int FORM_HEIGHT_WITH_ADVANCED = 781;
 
 void Main::createUI()
 {
@@ -1155,6 +1177,7 @@ void Main::createUI()
 
     _extraSpawnEnergyPerSegmentSlider = createSliderControl(_formAdvanced,"extraSpawnEnergyPerSegment", "Spawn energy:", 50, 2000);
 	_deadCellDormancySlider = createSliderControl(_formAdvanced, "deadCellDormancy", "Sprout turns:", 100, 50000);
+	_maxAgentsSlider = createSliderControl(_formAdvanced, "maxAgents", "Max agents:", 5000, 200000, 5000);
 	_photoSynthesizeEnergyGainSlider = createSliderControl(_formAdvanced, "photoSynthesizeEnergyGain", "Photosynthesis:", 1.0f, 5.0f);
     _moveEnergyCostSlider = createSliderControl(_formAdvanced, "moveEnergyCost", "Move:", 0, 5);
     _moveAndEatEnergyCostSlider = createSliderControl(_formAdvanced, "moveAndEatEnergyCost", "Move & eat:", 0, 15);
@@ -1276,6 +1299,8 @@ void Main::controlEvent(Control* control, EventType evt)
                 Parameters::instance.photoSynthesizeEnergyGain = _photoSynthesizeEnergyGainSlider->getValue();
 			else if (control == _deadCellDormancySlider)
 				Parameters::instance.deadCellDormancy = _deadCellDormancySlider->getValue();
+			else if (control == _maxAgentsSlider)
+				Parameters::instance.maxAgents = _maxAgentsSlider->getValue();
             else if (control == _moveEnergyCostSlider)
                 Parameters::instance.moveEnergyCost = _moveEnergyCostSlider->getValue();
             else if (control == _moveAndEatEnergyCostSlider)
@@ -1346,6 +1371,7 @@ void Main::updateControlLabels()
     updateControlLabel("cellSize", "%d", (int) Parameters::instance.cellSize);
     updateControlLabel("photoSynthesizeEnergyGain", "+%.1f", Parameters::instance.photoSynthesizeEnergyGain);
 	updateControlLabel("deadCellDormancy", "%d", Parameters::instance.deadCellDormancy/100);
+	updateControlLabel("maxAgents", "%dk", Parameters::instance.maxAgents/1000);
     updateControlLabel("moveEnergyCost", "-%.1f", Parameters::instance.moveEnergyCost);
     updateControlLabel("moveAndEatEnergyCost", "-%.1f", Parameters::instance.moveAndEatEnergyCost);
     updateControlLabel("mouthSize", "%.1f", Parameters::instance.mouthSize);
@@ -1366,6 +1392,7 @@ void Main::setControlValues()
 //    _cellSizeSlider->setValue(Parameters::instance.cellSize);
     _photoSynthesizeEnergyGainSlider->setValue(Parameters::instance.photoSynthesizeEnergyGain);
 	_deadCellDormancySlider->setValue(Parameters::instance.deadCellDormancy);
+	_maxAgentsSlider->setValue(Parameters::instance.maxAgents);
     _moveEnergyCostSlider->setValue(Parameters::instance.moveEnergyCost);
     _moveAndEatEnergyCostSlider->setValue(Parameters::instance.moveAndEatEnergyCost);
     _useNaturalMovement->setChecked(Parameters::instance.useNaturalMovement);
@@ -1716,7 +1743,8 @@ void Main :: handleFollowCritter(float elapsedTime)
 		return;
 	}
 
-//	LockWorldMutex m;
+	// the sim thread can grow the agent pool (and so move its chunk list) while stepping
+	LockWorldMutex m;
 
 	mFollowingIndex = world.getTopCritterIndex();
 	if (mFollowingIndex == -1)
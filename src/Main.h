@@ -157,7 +157,7 @@ private:
     void openURL(const char *pPath, bool externalBrowser = false);
     
 private:
-	static SphereWorld world;
+	SphereWorld world;
 	int mCurBarriers;
     float mUIScale;
     ArcBall _arcball;
@@ -203,6 +203,7 @@ private:
     Slider* _photoSynthesizeEnergyGainSlider;
     Slider* _photoSynthesizeBonusSlider;
     Slider* _deadCellDormancySlider;
+    Slider* _maxAgentsSlider;
     Slider* _moveEnergyCostSlider;
     Slider* _moveAndEatEnergyCostSlider;
     //Slider* _mouthSizeSlider;
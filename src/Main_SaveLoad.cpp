@@ -149,7 +149,7 @@ void Main :: handleSave(int i)
 	out.open(fileName, ios::binary);
 
 	static int endianIndicator = 1;
-	static int version = 1;
+	static int version = WORLD_SAVE_VERSION;
 
 	out.write((char*)&endianIndicator, sizeof(endianIndicator));
 	out.write((char*)&version, sizeof(version));
@@ -176,9 +176,11 @@ void Main :: handleLoad(int i)
 	in.read((char*)&endianIndicator, sizeof(endianIndicator));
 	in.read((char*)&version, sizeof(version));
 
-	in.read((char*)&Parameters::instance, sizeof(Parameters));
-	world.read(in);
+	// (maxAgents, the last parameter, was added in version 3. The world has its own copy of it from version 2)
+	in.read((char*)&Parameters::instance, version >= 3 ? sizeof(Parameters) : sizeof(Parameters) - sizeof(int));
+	world.read(in, version);
 	in.close();
+	Parameters::instance.maxAgents = world.getMaxAgents();
 
 	setControlValues();
 	updateControlLabels();
@@ -22,6 +22,7 @@
  */
 
 #include "Parameters.h"
+#include "Constants.h"
 
 Parameters Parameters :: instance;
 
@@ -74,4 +75,5 @@ void Parameters :: reset()
 	lookSpread = 1.03f;
 	cannibals = 1;
 	allowOr = false;
+	maxAgents = MAX_AGENTS;
 }
\ No newline at end of file
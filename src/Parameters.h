@@ -70,5 +70,8 @@ public:
 	int cannibals;
 	int allowOr;
 
+	// the most agents the world holds. (Saves hold the parameters as they are in memory, so this is last,
+	// and isn't in saves from before version 3)
+	int maxAgents;
 };
 #endif /* defined(__BioSphere__Parameters__) */
@@ -0,0 +1,180 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ Phylogeny
+
+ The family tree of the species, used to draw the genealogy. It used to be a map from each child
+ genome to its parent genome, which had to be searched through to find the children of a genome
+ (which every mutation did). Here each species is indexed by its ID, with links to its parent and
+ to its children, so that everything done with a species is constant time.
+
+ It used to be pruned every time the top species were sampled, by walking up from every living
+ genome and then looking through the whole map for what wasn't reached. Now each species counts
+ the living things under it, so the tree knows the moment a lineage dies out. A link is kept while
+ either end of it has a count, which is what the sweep kept. Only the species whose count changes
+ are looked at, walking up until one is reached whose count doesn't.
+ **/
+
+#include "Phylogeny.h"
+
+Phylogeny::Phylogeny()
+{
+    clear();
+}
+
+void Phylogeny::clear()
+{
+    mParent.clear();
+    mFirstChild.clear();
+    mNextSibling.clear();
+    mPrevSibling.clear();
+    mFirstTurn.clear();
+    mNumLiving.clear();
+}
+
+void Phylogeny::reserve(int species)
+{
+    if (species < (int) mParent.size())
+        return;
+
+    mParent.resize(species + 1, NOT_IN_TREE);
+    mFirstChild.resize(species + 1, -1);
+    mNextSibling.resize(species + 1, -1);
+    mPrevSibling.resize(species + 1, -1);
+    mFirstTurn.resize(species + 1, NO_FIRST_TURN);
+    mNumLiving.resize(species + 1, 0);
+}
+
+void Phylogeny::registerMutation(int species, int parentSpecies, long turn)
+{
+    if (isInTree(species) || hasChildren(species))
+        return;
+
+    link(species, parentSpecies);
+    setFirstTurn(species, turn);
+}
+
+void Phylogeny::link(int species, int parentSpecies)
+{
+    reserve(species);
+    reserve(parentSpecies);
+    if (isInTree(species))
+        return;
+
+    mParent[species] = parentSpecies;
+    if (parentSpecies == NO_PARENT)
+        return;
+
+    mPrevSibling[species] = -1;
+    mNextSibling[species] = mFirstChild[parentSpecies];
+    if (mFirstChild[parentSpecies] != -1)
+        mPrevSibling[mFirstChild[parentSpecies]] = species;
+    mFirstChild[parentSpecies] = species;
+
+    if (mNumLiving[species] > 0)
+        addLiving(parentSpecies);
+}
+
+/**
+ Takes the species out of the tree. Only done to species without a count, so nothing above it changes
+ **/
+void Phylogeny::unlink(int species)
+{
+    int parentSpecies = mParent[species];
+    mParent[species] = NOT_IN_TREE;
+    if (parentSpecies == NO_PARENT)
+        return;
+
+    if (mPrevSibling[species] == -1)
+        mFirstChild[parentSpecies] = mNextSibling[species];
+    else
+        mNextSibling[mPrevSibling[species]] = mNextSibling[species];
+    if (mNextSibling[species] != -1)
+        mPrevSibling[mNextSibling[species]] = mPrevSibling[species];
+    mNextSibling[species] = mPrevSibling[species] = -1;
+}
+
+void Phylogeny::setFirstTurn(int species, long turn)
+{
+    reserve(species);
+    mFirstTurn[species] = turn;
+}
+
+void Phylogeny::addLiving(int species)
+{
+    reserve(species);
+    while (species != NO_PARENT && mNumLiving[species]++ == 0)
+        species = getParent(species);
+}
+
+int Phylogeny::removeLiving(int species, std::vector<int> & released)
+{
+    int numUnlinked = 0;
+    while (species != NO_PARENT && --mNumLiving[species] == 0) {
+
+        // its children have no count either, so the links to them go
+        while (mFirstChild[species] != -1) {
+            released.push_back(mFirstChild[species]);
+            unlink(mFirstChild[species]);
+            ++numUnlinked;
+        }
+        released.push_back(species);
+
+        // and its own link goes when its parent dies out, which this might be about to do (a species
+        // without a parent has nothing to keep its link)
+        int parentSpecies = getParent(species);
+        if (parentSpecies == NO_PARENT && isInTree(species)) {
+            unlink(species);
+            ++numUnlinked;
+        }
+        species = parentSpecies;
+    }
+    return numUnlinked;
+}
+
+int Phylogeny::removeDeadLinks(std::vector<int> & released)
+{
+    // (taking out a link between two species without a count doesn't change any count, so one pass will do)
+    int numUnlinked = 0;
+    for (int species = 0; species < (int) mParent.size(); species++) {
+        if (! isInTree(species) || mNumLiving[species] > 0)
+            continue;
+
+        int parentSpecies = mParent[species];
+        if (parentSpecies != NO_PARENT && mNumLiving[parentSpecies] > 0)
+            continue;
+
+        unlink(species);
+        released.push_back(species);
+        if (parentSpecies != NO_PARENT)
+            released.push_back(parentSpecies);
+        ++numUnlinked;
+    }
+    return numUnlinked;
+}
+
+void Phylogeny::forget(int species)
+{
+    if (species >= (int) mParent.size())
+        return;
+
+    mFirstTurn[species] = NO_FIRST_TURN;
+    mNumLiving[species] = 0;
+}
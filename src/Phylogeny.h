@@ -0,0 +1,91 @@
+//
+//  Phylogeny.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_Phylogeny_h
+#define MutationPlanet_Phylogeny_h
+
+#include "Constants.h"
+#include <vector>
+
+// a species whose parent isn't known (only found in saves)
+#define NO_PARENT -1
+
+/**
+ Which species each species mutated from, and the turn it first appeared, by species ID (see
+ SpeciesTable). Each species also links to its children, so that looking a species up in either
+ direction doesn't mean searching the others.
+
+ The tree only keeps the lineages of the living species. Each species counts itself (while it has
+ living agents) and each of its children that has a count, and when its count drops to zero its
+ links go
+ **/
+class Phylogeny
+{
+public:
+    Phylogeny();
+
+    void clear();
+
+    // records that the species mutated from the parent on the given turn, unless it is already in the tree
+    // (as a child or a parent)
+    void registerMutation(int species, int parentSpecies, long turn);
+
+    // adds the species to the tree as a child of the parent (or of nothing, given NO_PARENT), unless it is
+    // already in it
+    void link(int species, int parentSpecies);
+
+    // called when a species gets its first living agent, and when it loses its last. The second takes the
+    // links of the lineages that died out with it out of the tree, appends the species that it let go of
+    // to released, and returns the number of links taken out
+    void addLiving(int species);
+    int removeLiving(int species, std::vector<int> & released);
+
+    // takes out the links with no count at either end, which a save from before the tree was pruned as it
+    // went can have whole lineages of. Appends the species at both ends to released, and returns the number
+    // of links taken out
+    int removeDeadLinks(std::vector<int> & released);
+
+    // clears what's known about a species, before its ID is reused. It must not be in the tree
+    void forget(int species);
+
+    // whether the species has a parent link (even to NO_PARENT)
+    bool isInTree(int species) { return species < (int) mParent.size() && mParent[species] != NOT_IN_TREE; }
+
+    // the parent, or NO_PARENT if the species has none or isn't in the tree
+    int getParent(int species) { return isInTree(species) ? mParent[species] : NO_PARENT; }
+
+    // the children of a species are listed from getFirstChild() through getNextSibling(), ending with -1
+    int getFirstChild(int species) { return species < (int) mFirstChild.size() ? mFirstChild[species] : -1; }
+    int getNextSibling(int species) { return mNextSibling[species]; }
+    bool hasChildren(int species) { return getFirstChild(species) != -1; }
+
+    bool hasFirstTurn(int species) { return species < (int) mFirstTurn.size() && mFirstTurn[species] != NO_FIRST_TURN; }
+    long getFirstTurn(int species) { return hasFirstTurn(species) ? mFirstTurn[species] : 0; }
+    void setFirstTurn(int species, long turn);
+
+    // species IDs in the tree (or with a first turn) are all below this
+    int getNumSpecies() { return (int) mParent.size(); }
+
+private:
+    enum { NOT_IN_TREE = -2 };
+    enum { NO_FIRST_TURN = -1 };
+
+    void reserve(int species);
+    void unlink(int species);
+
+    // the parent of each species, and its children as a list linked both ways through the siblings
+    std::vector<int> mParent;
+    std::vector<int> mFirstChild;
+    std::vector<int> mNextSibling;
+    std::vector<int> mPrevSibling;
+
+    std::vector<long> mFirstTurn;
+
+    // the number of living things under each species: itself, and its children with a count
+    std::vector<int> mNumLiving;
+};
+
+#endif
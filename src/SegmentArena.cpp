@@ -0,0 +1,102 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ SegmentArena
+
+ Every agent used to have MAX_SEGMENTS segments set aside next to it in the agent pool, though most
+ agents are food with a single segment, so most of that memory was never touched and the segments in
+ use were spread out over all of it. Here the segments are handed out in runs of 1, 2, 4, 8 or
+ MAX_SEGMENTS, each size from its own blocks. A run that is let go of is the next one of its size to
+ be handed out, so the segments in use stay together in the blocks that are already warm.
+
+ The runs aren't moved to close the gaps left by agents that die, as the point finders keep pointers
+ to the segments, but reusing the gaps first has much the same effect.
+ **/
+
+#include "SegmentArena.h"
+
+static const int sRunSizes[NUM_SEGMENT_CLASSES] = {1, 2, 4, 8, MAX_SEGMENTS};
+
+SegmentArena::SegmentArena()
+{
+    mNumAllocated = 0;
+    clear();
+}
+
+SegmentArena::~SegmentArena()
+{
+    for (int c = 0; c < NUM_SEGMENT_CLASSES; c++) {
+        for (size_t i = 0; i < mBlocks[c].size(); i++)
+            delete[] mBlocks[c][i];
+    }
+}
+
+void SegmentArena::clear()
+{
+    mNumInUse = 0;
+    for (int c = 0; c < NUM_SEGMENT_CLASSES; c++) {
+        int runSize = getRunSize(c);
+        mFree[c].clear();
+
+        // (backwards, so that the runs are handed out in order)
+        for (int i = (int) mBlocks[c].size() - 1; i >= 0; i--) {
+            for (int run = SEGMENT_BLOCK_RUNS - 1; run >= 0; run--)
+                mFree[c].push_back(mBlocks[c][i] + run * runSize);
+        }
+    }
+}
+
+int SegmentArena::getSizeClass(int numSegments)
+{
+    int c = 0;
+    while (sRunSizes[c] < numSegments)
+        ++c;
+    return c;
+}
+
+int SegmentArena::getRunSize(int sizeClass)
+{
+    return sRunSizes[sizeClass];
+}
+
+SphereEntity * SegmentArena::allocate(int numSegments)
+{
+    int c = getSizeClass(numSegments);
+    int runSize = getRunSize(c);
+    if (mFree[c].empty()) {
+        SphereEntity *pBlock = new SphereEntity[SEGMENT_BLOCK_RUNS * runSize];
+        mBlocks[c].push_back(pBlock);
+        for (int run = SEGMENT_BLOCK_RUNS - 1; run >= 0; run--)
+            mFree[c].push_back(pBlock + run * runSize);
+        mNumAllocated += SEGMENT_BLOCK_RUNS * runSize;
+    }
+
+    SphereEntity *pResult = mFree[c].back();
+    mFree[c].pop_back();
+    mNumInUse += runSize;
+    return pResult;
+}
+
+void SegmentArena::release(SphereEntity *pSegments, int numSegments)
+{
+    int c = getSizeClass(numSegments);
+    mFree[c].push_back(pSegments);
+    mNumInUse -= getRunSize(c);
+}
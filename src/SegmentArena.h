@@ -0,0 +1,57 @@
+//
+//  SegmentArena.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_SegmentArena_h
+#define MutationPlanet_SegmentArena_h
+
+#include "Constants.h"
+#include "SphereEntity.h"
+#include <vector>
+
+// the sizes of run that segments are handed out in: the powers of two, and then MAX_SEGMENTS
+#define NUM_SEGMENT_CLASSES 5
+
+// the runs of each size are allocated in blocks of this many, so that they never move once handed out
+#define SEGMENT_BLOCK_RUNS 256
+
+/**
+ The segments of the agents in a world. Each agent gets a run of the smallest size that holds its
+ segments, rather than room for MAX_SEGMENTS, and its run goes back to be reused when it dies
+ **/
+class SegmentArena
+{
+public:
+    SegmentArena();
+    ~SegmentArena();
+
+    // frees every run. The blocks are kept to be reused
+    void clear();
+
+    // returns a run of at least numSegments segments, left as the last agent to have it left it
+    SphereEntity * allocate(int numSegments);
+    void release(SphereEntity *pSegments, int numSegments);
+
+    // the segments handed out, counting whole runs, and the segments allocated
+    int getNumInUse() { return mNumInUse; }
+    int getNumAllocated() { return mNumAllocated; }
+
+private:
+    static int getSizeClass(int numSegments);
+    static int getRunSize(int sizeClass);
+
+    // the blocks of each size of run, and the runs of each size that are free (the last freed at the back)
+    std::vector<SphereEntity*> mBlocks[NUM_SEGMENT_CLASSES];
+    std::vector<SphereEntity*> mFree[NUM_SEGMENT_CLASSES];
+
+    int mNumInUse;
+    int mNumAllocated;
+
+    // not copyable, as the blocks are owned
+    SegmentArena(const SegmentArena &);
+    SegmentArena & operator=(const SegmentArena &);
+};
+
+#endif
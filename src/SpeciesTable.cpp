@@ -0,0 +1,183 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ SpeciesTable
+
+ Interns genomes: each distinct genome is stored once, and its index is the species ID. The genomes
+ are found by a hash, chained per bucket. When a species is no longer used by any agent or by the
+ family tree, the world removes it, and its ID is given to the next new genome, so the table only
+ grows with the number of species around at once, rather than the number there have ever been.
+
+ The counts are kept in order by keeping the species in an array sorted by count, where the species
+ with the same count form a block. Adding one to a species' count swaps it to the front of its block,
+ which is then one shorter, leaving it at the end of the block for the next count up (and taking one
+ off swaps it to the end, the other way). Either way the order is kept with one swap.
+
+ Each world has its own table, so that worlds on separate threads don't have to share one.
+ **/
+
+#include "SpeciesTable.h"
+#include <string.h>
+
+// the initial number of hash buckets, and the number of species per bucket before there are twice as many
+#define INITIAL_BUCKETS 1024
+#define MAX_BUCKET_LOAD 2
+
+SpeciesTable::SpeciesTable()
+{
+    clear();
+}
+
+void SpeciesTable::clear()
+{
+    mGenomes.clear();
+    mHash.clear();
+    mReferences.clear();
+    mRemoved.clear();
+    mNext.clear();
+    mBucketHead.assign(INITIAL_BUCKETS, -1);
+
+    mCount.clear();
+    mByRank.clear();
+    mRank.clear();
+    mNumAbove.clear();
+}
+
+unsigned SpeciesTable::hashGenome(const char *pGenome)
+{
+    // FNV-1a
+    unsigned hash = 2166136261u;
+    for (; *pGenome; ++pGenome)
+        hash = (hash ^ (unsigned char) *pGenome) * 16777619u;
+    return hash;
+}
+
+int SpeciesTable::find(const char *pGenome, unsigned hash)
+{
+    for (int i = mBucketHead[hash & (mBucketHead.size() - 1)]; i != -1; i = mNext[i]) {
+        if (mHash[i] == hash && strcmp(mGenomes[i], pGenome) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int SpeciesTable::find(const char *pGenome)
+{
+    return find(pGenome, hashGenome(pGenome));
+}
+
+int SpeciesTable::intern(const char *pGenome)
+{
+    unsigned hash = hashGenome(pGenome);
+    int result = find(pGenome, hash);
+    if (result != -1)
+        return result;
+
+    if (mRemoved.empty()) {
+        result = (int) mGenomes.size();
+        mGenomes.push_back(Genome());
+        mHash.push_back(0);
+        mReferences.push_back(0);
+        mNext.push_back(-1);
+
+        // (a count of 0 goes last)
+        mCount.push_back(0);
+        mRank.push_back(result);
+        mByRank.push_back(result);
+    }
+    else {
+        // (a removed species has a count of 0, so it is already ranked with those)
+        result = mRemoved.back();
+        mRemoved.pop_back();
+        mReferences[result] = 0;
+    }
+
+    mGenomes[result].initialize(pGenome);
+    mHash[result] = hash;
+
+    size_t bucket = hash & (mBucketHead.size() - 1);
+    mNext[result] = mBucketHead[bucket];
+    mBucketHead[bucket] = result;
+
+    if (mGenomes.size() - mRemoved.size() > mBucketHead.size() * MAX_BUCKET_LOAD)
+        growBuckets();
+    return result;
+}
+
+void SpeciesTable::remove(int species)
+{
+    size_t bucket = mHash[species] & (mBucketHead.size() - 1);
+    if (mBucketHead[bucket] == species)
+        mBucketHead[bucket] = mNext[species];
+    else {
+        int i = mBucketHead[bucket];
+        while (mNext[i] != species)
+            i = mNext[i];
+        mNext[i] = mNext[species];
+    }
+
+    mReferences[species] = REMOVED;
+    mRemoved.push_back(species);
+}
+
+void SpeciesTable::swapRanks(int rank1, int rank2)
+{
+    int species1 = mByRank[rank1];
+    int species2 = mByRank[rank2];
+    mByRank[rank1] = species2;
+    mRank[species2] = rank1;
+    mByRank[rank2] = species1;
+    mRank[species1] = rank2;
+}
+
+void SpeciesTable::addToCount(int species)
+{
+    int count = mCount[species];
+    if (count + 1 >= (int) mNumAbove.size())
+        mNumAbove.resize(count + 2, 0);
+
+    swapRanks(mRank[species], mNumAbove[count]);
+    ++mNumAbove[count];
+    ++mCount[species];
+}
+
+void SpeciesTable::removeFromCount(int species)
+{
+    int count = mCount[species];
+    swapRanks(mRank[species], mNumAbove[count - 1] - 1);
+    --mNumAbove[count - 1];
+    --mCount[species];
+}
+
+void SpeciesTable::growBuckets()
+{
+    // (removed species aren't in any chain, so go through the chains rather than the IDs)
+    std::vector<int> oldBucketHead(mBucketHead.size() * 2, -1);
+    oldBucketHead.swap(mBucketHead);
+    for (size_t oldBucket = 0; oldBucket < oldBucketHead.size(); oldBucket++) {
+        int next;
+        for (int i = oldBucketHead[oldBucket]; i != -1; i = next) {
+            next = mNext[i];
+            size_t bucket = mHash[i] & (mBucketHead.size() - 1);
+            mNext[i] = mBucketHead[bucket];
+            mBucketHead[bucket] = i;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+//
+//  SpeciesTable.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_SpeciesTable_h
+#define MutationPlanet_SpeciesTable_h
+
+#include "Constants.h"
+#include "Genome.h"
+#include <vector>
+
+/**
+ The genomes in use in a world, each stored once and known by a species ID, so that agents can be
+ compared (and species kept track of) by integer rather than by string. Also keeps the number of
+ living agents of each species, and the species in order of that number
+ **/
+class SpeciesTable
+{
+public:
+    SpeciesTable();
+
+    void clear();
+
+    // returns the genome's species ID, giving it a new one (or one that was removed) if it isn't known
+    int intern(const char *pGenome);
+
+    // forgets a species, whose ID can then be given to another genome. It must have no references and no count
+    void remove(int species);
+
+    // returns the genome's species ID, or -1 if it hasn't been seen
+    int find(const char *pGenome);
+
+    // (the reference is only good until the next genome is interned)
+    const Genome & getGenome(int species) { return mGenomes[species]; }
+
+    // species IDs are all below this
+    int getNumSpecies() { return (int) mGenomes.size(); }
+
+    // the agents using a species (it isn't removed while they are, but it's up to the world to remove it)
+    void addReference(int species) { ++mReferences[species]; }
+    void removeReference(int species) { --mReferences[species]; }
+
+    // whether a species is known, but no agents are using it
+    bool isUnreferenced(int species) { return mReferences[species] == 0; }
+
+    void addToCount(int species);
+    void removeFromCount(int species);
+    int getCount(int species) { return mCount[species]; }
+
+    // the species with a count, most numerous first
+    int getNumLivingSpecies() { return mNumAbove.empty() ? 0 : mNumAbove[0]; }
+    int getSpeciesByRank(int rank) { return mByRank[rank]; }
+
+private:
+    static unsigned hashGenome(const char *pGenome);
+    int find(const char *pGenome, unsigned hash);
+    void growBuckets();
+
+    std::vector<Genome> mGenomes;
+    std::vector<unsigned> mHash;
+
+    // the number of agents using each species, or REMOVED, and the IDs that have been removed
+    enum { REMOVED = -1 };
+    std::vector<int> mReferences;
+    std::vector<int> mRemoved;
+
+    // a chain of species per hash bucket, linked through mNext. The number of buckets is a power of two
+    std::vector<int> mNext;
+    std::vector<int> mBucketHead;
+
+    // the count of each species, every species ordered by count (highest first), and each one's place in that
+    // order. mNumAbove[c] is the number of species with a count over c, which is where those with c start
+    std::vector<int> mCount;
+    std::vector<int> mByRank;
+    std::vector<int> mRank;
+    std::vector<int> mNumAbove;
+
+    void swapRanks(int rank1, int rank2);
+};
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "gameplay.h"
 #include "Constants.h"
+#include "InstructionSet.h"
 
 using namespace gameplay;
 using namespace std;
@@ -58,6 +59,7 @@ public:
 		mAgent = NULL;
 		mWorld = NULL;
 		mInserted = false;
+        mFinderSlot = -1;
         mScale = 1.0f;
 	}
     
@@ -69,6 +71,7 @@ public:
 		mAgent = NULL;
 		mWorld = NULL;
 		mInserted = false;
+        mFinderSlot = -1;
         mScale = 1.0f;
     }
     
@@ -83,10 +86,43 @@ public:
 
 	SphereEntity * mSpherePrev, *mSphereNext;
 	SphereEntityPoint3d mSpherePoint;
+	int mFinderSlot; // position within SpherePointFinderCellSorted's arrays
 };
 
 typedef SphereEntity * SphereEntityPtr;
 
+/**
+ * The kinds of segment that the point finders count in each of their buckets, so that a query can tell
+ * which kinds a bucket holds without touching the entities in it.
+ */
+enum eEntityKind {
+    eEntityFood,        // photosynthesize segments
+    eEntityBarrier,
+    eEntityMotile,      // move and move-and-eat segments
+
+    eNumEntityKinds,
+    eEntityOther = eNumEntityKinds    // anything else, which isn't counted
+};
+
+#define ENTITY_KIND_BIT(kind) (1u << (kind))
+#define ALL_ENTITY_KINDS ((1u << eNumEntityKinds) - 1)
+
+// for filtering queries by kind: the counted kinds, plus the uncounted ones
+#define ANY_ENTITY_KIND (ALL_ENTITY_KINDS | ENTITY_KIND_BIT(eEntityOther))
+
+inline int getEntityKind(char type) {
+    switch (type) {
+        case eInstructionPhotosynthesize:
+            return eEntityFood;
+        case eBarrier1: case eBarrier2: case eBarrier3: case eBarrier4:
+            return eEntityBarrier;
+        case eInstructionMove: case eInstructionMoveAndEat:
+            return eEntityMotile;
+        default:
+            return eEntityOther;
+    }
+}
+
 // use the cheap "Manhattan distance" method....
 inline float calcDistance(const Vector3 &v1, const Vector3 &v2)
 {
@@ -0,0 +1,784 @@
+/************************************************************************
+ MutationPlanet
+ Copyright (C) 2012, Scott Schafer, scott.schafer@gmail.com
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+
+/**
+ SpherePointFinderCellSorted
+
+ Every entity lies on the surface of the unit sphere, so rather than dividing the whole cube
+ around it (most of which is empty), this covers only the surface, using a "cubed sphere" grid:
+ each entity is projected onto the face of the cube in the direction of its largest coordinate,
+ and each face is divided into a square grid of cells. The face coordinates are warped (as in
+ Google's S2 library) so that the cells are close to the same size on the sphere.
+
+ The number of cells along each face is chosen from the cell size (which sets the size of most
+ queries) and the number of entities, and is revisited whenever the arrays are re-sorted.
+
+ Rather than threading the entities through a linked list per cell, their locations are copied
+ into flat arrays that are sorted by cell (using a counting sort). A query then scans a contiguous
+ run of those arrays for each row of cells it covers, and only touches the SphereEntity itself
+ when it is within range.
+
+ Keeping the arrays sorted on every insert would be expensive, so entities that are inserted
+ (or that move into a different cell) are appended past the sorted region and chained per cell,
+ and removed entities are left behind as holes. Once enough of these have built up, the arrays
+ are re-sorted.
+
+ Each cell also keeps a count of the food, barrier and motile segments in it, with an occupancy bitmap
+ per kind, so getKindsNear() only has to look at the bitmaps.
+
+ Rows of cells with nothing in them are skipped using the occupancy bitmap, a word at a time. There is
+ no coarser level over the grid, unlike the 4x4x4 blocks of the linked-list finder. A row that isn't
+ skipped is one contiguous run, so scanning it already costs about what it returns. A coarse level was
+ tried, and it made capped queries 5-25% slower and only helped very wide uncapped ones.
+
+ findNearest() searches a cube around the point that doubles in size each time, until it has found
+ enough entities within it. The cells a cube covers only grow as it does, so each pass only scans the
+ cells that the passes before it didn't. The entities those passes looked at but found outside their
+ cube are kept, and each pass takes the ones that are inside its own cube.
+ **/
+
+#include "SpherePointFinderCellSorted.h"
+#include "UtilsBits.h"
+
+#if SIMD_DISTANCE_FILTER
+	#if defined(__AVX512F__)
+		#include <immintrin.h>
+		#define SIMD_LANES 16
+	#elif defined(__AVX2__) || defined(__AVX__)
+		#include <immintrin.h>
+		#define SIMD_LANES 8
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#include <emmintrin.h>
+		#define SIMD_LANES 4
+	#endif
+#endif
+
+#define CELL_INDEX(face,u,v) (((face)*mFaceSubdivisions + (v))*mFaceSubdivisions + (u))
+#define KIND_COUNT(cell,kind) mKindCount[(cell) * eNumEntityKinds + (kind)]
+
+// a removed entity's coordinates are set to this, so that it never passes the distance test
+#define REMOVED_COORDINATE 1.0e30f
+
+// the minimum number of unsorted or removed slots that will trigger a rebuild
+#define MIN_REBUILD_SLOTS 256
+
+// the range of resolutions that can be chosen, in cells along each face
+#define MIN_FACE_SUBDIVISIONS 4
+#define MAX_FACE_SUBDIVISIONS 128
+
+// cells are made this many times the cell size across, so that most queries touch only a few of them...
+#define CELL_WIDTH_PER_CELL_SIZE 4
+
+// ...but no smaller than it takes to hold this many entities each, on average
+#define TARGET_CELL_OCCUPANCY 4
+
+// the resolution is only changed if the best one differs from it by more than this fraction
+#define RESOLUTION_TOLERANCE .2f
+
+// the area of the unit sphere, and the width of a cell when each face has one cell (sqrt(4 PI / 6))
+#define SPHERE_AREA 12.566f
+#define FACE_WIDTH 1.4472f
+
+// the size of the first cube that findNearest() searches, as a fraction of a cell's width
+#define NEAREST_START_FRACTION .5f
+
+// a point on the unit sphere has its largest coordinate at least 1/sqrt(3); this leaves some
+// slack for locations that are not quite normalized
+#define MIN_MAJOR_COORDINATE .5f
+
+// the coordinates that run along each face, for the faces whose major axis is x, y and z
+static const int uAxis[3] = { 1, 2, 0 };
+static const int vAxis[3] = { 2, 0, 1 };
+
+// maps a face coordinate in [-1,1] to a cell. The quadratic warp evens out the cell sizes, which would
+// otherwise be over 5 times larger (in area) at the middle of a face than at its corners
+static inline int toFaceCoordinate(float u, int faceSubdivisions)
+{
+	float s = (u >= 0) ? .5f * sqrtf(1 + 3 * u) : 1 - .5f * sqrtf(1 - 3 * u);
+	return max(min(faceSubdivisions - 1, int (s * faceSubdivisions)), 0);
+}
+
+int SpherePointFinderCellSorted::getCellIndex(const Vector3 & v)
+{
+	float ax = fabsf(v.x), ay = fabsf(v.y), az = fabsf(v.z);
+
+	if (ax >= ay && ax >= az)
+		return CELL_INDEX(v.x > 0 ? 0 : 1, toFaceCoordinate(v.y / ax, mFaceSubdivisions), toFaceCoordinate(v.z / ax, mFaceSubdivisions));
+	else if (ay >= az)
+		return CELL_INDEX(v.y > 0 ? 2 : 3, toFaceCoordinate(v.z / ay, mFaceSubdivisions), toFaceCoordinate(v.x / ay, mFaceSubdivisions));
+	else
+		return CELL_INDEX(v.z > 0 ? 4 : 5, toFaceCoordinate(v.x / az, mFaceSubdivisions), toFaceCoordinate(v.y / az, mFaceSubdivisions));
+}
+
+SpherePointFinderCellSorted::SpherePointFinderCellSorted()
+{
+	mNumSorted = mNumSlots = mNumLive = 0;
+	mCellSize = 0;
+	mFaceSubdivisions = 0;
+	setResolution(CUBE_FACE_SUBDIVISIONS);
+}
+
+void SpherePointFinderCellSorted::clear()
+{
+	std::fill(mCellStart.begin(), mCellStart.end(), 0);
+	std::fill(mPatchHead.begin(), mPatchHead.end(), -1);
+	std::fill(mCellCount.begin(), mCellCount.end(), 0);
+	std::fill(mOccupied.begin(), mOccupied.end(), 0);
+	std::fill(mKindCount.begin(), mKindCount.end(), 0);
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		std::fill(mKindOccupied[kind].begin(), mKindOccupied[kind].end(), 0);
+
+	mX.clear();
+	mY.clear();
+	mZ.clear();
+	mEntities.clear();
+	mCell.clear();
+	mPatchNext.clear();
+
+	mNumSorted = mNumSlots = mNumLive = 0;
+}
+
+void SpherePointFinderCellSorted::appendSlot(SphereEntity * pEntity, int cell)
+{
+	int slot = mNumSlots++;
+
+	mX.push_back(pEntity->mLocation.x);
+	mY.push_back(pEntity->mLocation.y);
+	mZ.push_back(pEntity->mLocation.z);
+	mEntities.push_back(pEntity);
+	mCell.push_back(cell);
+
+	mPatchNext.push_back(mPatchHead[cell]);
+	mPatchHead[cell] = slot;
+	addToCell(cell, getEntityKind(pEntity->mType));
+
+	pEntity->mFinderSlot = slot;
+}
+
+void SpherePointFinderCellSorted::insert(SphereEntity * pEntity)
+{
+	appendSlot(pEntity, getCellIndex(pEntity->mLocation));
+	pEntity->mInserted = true;
+	++mNumLive;
+
+	// the unsorted and removed slots all cost extra when querying, so re-sort once there are too many
+	if ((mNumSlots - mNumLive) + (mNumSlots - mNumSorted) > MIN_REBUILD_SLOTS + mNumLive / 4)
+		rebuild();
+}
+
+void SpherePointFinderCellSorted::remove(SphereEntity * pEntity)
+{
+	if (! pEntity->mInserted) {
+		return;
+	}
+	pEntity->mInserted = false;
+
+	int slot = pEntity->mFinderSlot;
+	removeFromCell(mCell[slot], getEntityKind(pEntity->mType));
+	mEntities[slot] = NULL;
+	mX[slot] = mY[slot] = mZ[slot] = REMOVED_COORDINATE;
+	--mNumLive;
+
+	pEntity->mFinderSlot = -1;
+}
+
+void SpherePointFinderCellSorted::moveEntity(SphereEntity * pEntity, Vector3 newLoc)
+{
+	int slot = pEntity->mFinderSlot;
+
+	if (pEntity->mInserted && getCellIndex(newLoc) == mCell[slot])
+	{
+		// still in the same subdivision, so just update the location in place
+	    pEntity->mLocation = newLoc;
+		mX[slot] = newLoc.x;
+		mY[slot] = newLoc.y;
+		mZ[slot] = newLoc.z;
+	}
+	else
+	{
+		remove(pEntity);
+	    pEntity->mLocation = newLoc;
+		insert(pEntity);
+	}
+}
+
+/**
+ Picks the number of cells along each face: cells should be a few times wider than the cell size, which
+ sets the size of most queries, but wide enough to hold a few entities each.
+ **/
+int SpherePointFinderCellSorted::chooseResolution()
+{
+	float width = sqrtf(SPHERE_AREA * TARGET_CELL_OCCUPANCY / max(mNumLive, 1));
+	width = max(width, mCellSize * CELL_WIDTH_PER_CELL_SIZE);
+
+	return max(MIN_FACE_SUBDIVISIONS, min(MAX_FACE_SUBDIVISIONS, int(FACE_WIDTH / width + .5f)));
+}
+
+void SpherePointFinderCellSorted::setCellSize(float cellSize)
+{
+	if (cellSize != mCellSize)
+	{
+		mCellSize = cellSize;
+		rebuild();
+	}
+}
+
+/**
+ Switches to a grid with the given number of cells along each face, re-bucketing every entity in one pass
+ **/
+void SpherePointFinderCellSorted::setResolution(int faceSubdivisions)
+{
+	mFaceSubdivisions = faceSubdivisions;
+
+	int numCells = 6 * faceSubdivisions * faceSubdivisions;
+	mCellStart.assign(numCells + 1, 0);
+	mPatchHead.assign(numCells, -1);
+	mCellCount.assign(numCells, 0);
+	mOccupied.assign((numCells + 31) / 32, 0);
+	mKindCount.assign(numCells * eNumEntityKinds, 0);
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		mKindOccupied[kind].assign((numCells + 31) / 32, 0);
+
+	for (int slot = 0; slot < mNumSlots; slot++)
+		if (mEntities[slot] != NULL)
+			mCell[slot] = getCellIndex(Vector3(mX[slot], mY[slot], mZ[slot]));
+
+	// the patch chains are already cleared, so treat every slot as sorted
+	mNumSorted = mNumSlots;
+	sortCells();
+}
+
+void SpherePointFinderCellSorted::rebuild()
+{
+	// the population or the cell size may have drifted far enough to call for a different grid
+	int faceSubdivisions = chooseResolution();
+	if (abs(faceSubdivisions - mFaceSubdivisions) > mFaceSubdivisions * RESOLUTION_TOLERANCE)
+		setResolution(faceSubdivisions);
+	else
+		sortCells();
+}
+
+void SpherePointFinderCellSorted::sortCells()
+{
+	int numCells = (int) mPatchHead.size();
+
+	// count the live entities in each cell, and of each kind...
+	std::fill(mCellStart.begin(), mCellStart.end(), 0);
+	std::fill(mKindCount.begin(), mKindCount.end(), 0);
+	for (int slot = 0; slot < mNumSlots; slot++)
+	{
+		if (slot >= mNumSorted)
+			mPatchHead[mCell[slot]] = -1;
+		if (mEntities[slot] != NULL)
+		{
+			++mCellStart[mCell[slot]];
+
+			int kind = getEntityKind(mEntities[slot]->mType);
+			if (kind != eEntityOther)
+				++KIND_COUNT(mCell[slot], kind);
+		}
+	}
+
+	// ...turn the counts into the offset of each cell, refreshing the occupancy bits along the way...
+	std::fill(mOccupied.begin(), mOccupied.end(), 0);
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		std::fill(mKindOccupied[kind].begin(), mKindOccupied[kind].end(), 0);
+	int offset = 0;
+	for (int cell = 0; cell < numCells; cell++)
+	{
+		int count = mCellStart[cell];
+		mCellStart[cell] = offset;
+		offset += count;
+
+		mCellCount[cell] = count;
+		if (count)
+			mOccupied[cell >> 5] |= 1u << (cell & 31);
+
+		for (int kind = 0; kind < eNumEntityKinds; kind++)
+			if (KIND_COUNT(cell, kind))
+				mKindOccupied[kind][cell >> 5] |= 1u << (cell & 31);
+	}
+	mCellStart[numCells] = offset;
+
+	// ...then scatter the entities into place. This leaves each mCellStart[c] pointing to the end
+	// of cell c, which is the start of cell c+1, so shift them back afterwards
+	mSortX.resize(mNumLive);
+	mSortY.resize(mNumLive);
+	mSortZ.resize(mNumLive);
+	mSortEntities.resize(mNumLive);
+	mSortCell.resize(mNumLive);
+
+	for (int slot = 0; slot < mNumSlots; slot++)
+	{
+		SphereEntity * pEntity = mEntities[slot];
+		if (pEntity == NULL)
+			continue;
+
+		int cell = mCell[slot];
+		int newSlot = mCellStart[cell]++;
+
+		mSortX[newSlot] = mX[slot];
+		mSortY[newSlot] = mY[slot];
+		mSortZ[newSlot] = mZ[slot];
+		mSortEntities[newSlot] = pEntity;
+		mSortCell[newSlot] = cell;
+		pEntity->mFinderSlot = newSlot;
+	}
+
+	memmove(&mCellStart[1], &mCellStart[0], sizeof(int) * numCells);
+	mCellStart[0] = 0;
+
+	mX.swap(mSortX);
+	mY.swap(mSortY);
+	mZ.swap(mSortZ);
+	mEntities.swap(mSortEntities);
+	mCell.swap(mSortCell);
+	mPatchNext.resize(mNumLive);
+
+	mNumSorted = mNumSlots = mNumLive;
+}
+
+/**
+ Returns a bit for each of the SIMD_LANES slots starting at i, set if the slot is within distance of the point.
+ This is the same test as calcDistance(): the largest difference along any axis.
+ **/
+#if SIMD_LANES == 16
+static inline unsigned nearbyMask(const float *x, const float *y, const float *z, int i, __m512 px, __m512 py, __m512 pz, __m512 dist)
+{
+	__m512 dx = _mm512_abs_ps(_mm512_sub_ps(px, _mm512_loadu_ps(x + i)));
+	__m512 dy = _mm512_abs_ps(_mm512_sub_ps(py, _mm512_loadu_ps(y + i)));
+	__m512 dz = _mm512_abs_ps(_mm512_sub_ps(pz, _mm512_loadu_ps(z + i)));
+	return _mm512_cmp_ps_mask(_mm512_max_ps(dx, _mm512_max_ps(dy, dz)), dist, _CMP_LE_OQ);
+}
+#elif SIMD_LANES == 8
+static inline unsigned nearbyMask(const float *x, const float *y, const float *z, int i, __m256 px, __m256 py, __m256 pz, __m256 dist)
+{
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+	__m256 dx = _mm256_andnot_ps(signBit, _mm256_sub_ps(px, _mm256_loadu_ps(x + i)));
+	__m256 dy = _mm256_andnot_ps(signBit, _mm256_sub_ps(py, _mm256_loadu_ps(y + i)));
+	__m256 dz = _mm256_andnot_ps(signBit, _mm256_sub_ps(pz, _mm256_loadu_ps(z + i)));
+	return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_max_ps(dx, _mm256_max_ps(dy, dz)), dist, _CMP_LE_OQ));
+}
+#elif SIMD_LANES == 4
+static inline unsigned nearbyMask(const float *x, const float *y, const float *z, int i, __m128 px, __m128 py, __m128 pz, __m128 dist)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 dx = _mm_andnot_ps(signBit, _mm_sub_ps(px, _mm_loadu_ps(x + i)));
+	__m128 dy = _mm_andnot_ps(signBit, _mm_sub_ps(py, _mm_loadu_ps(y + i)));
+	__m128 dz = _mm_andnot_ps(signBit, _mm_sub_ps(pz, _mm_loadu_ps(z + i)));
+	return _mm_movemask_ps(_mm_cmple_ps(_mm_max_ps(dx, _mm_max_ps(dy, dz)), dist));
+}
+#endif
+
+/**
+ Adds the entities in slots [slot, endSlot) that are within distance. The SIMD path visits the slots in the same
+ order as the scalar one, so it stops at the same entity when the results fill up. Returns true once they are full.
+ **/
+bool SpherePointFinderCellSorted::scanRun(int slot, int endSlot, const Vector3 &pt, float distance, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude)
+{
+#if defined(SIMD_LANES)
+	if (endSlot - slot >= SIMD_LANES)
+	{
+		const float *x = &mX[0], *y = &mY[0], *z = &mZ[0];
+	#if SIMD_LANES == 16
+		__m512 px = _mm512_set1_ps(pt.x), py = _mm512_set1_ps(pt.y), pz = _mm512_set1_ps(pt.z), dist = _mm512_set1_ps(distance);
+	#elif SIMD_LANES == 8
+		__m256 px = _mm256_set1_ps(pt.x), py = _mm256_set1_ps(pt.y), pz = _mm256_set1_ps(pt.z), dist = _mm256_set1_ps(distance);
+	#else
+		__m128 px = _mm_set1_ps(pt.x), py = _mm_set1_ps(pt.y), pz = _mm_set1_ps(pt.z), dist = _mm_set1_ps(distance);
+	#endif
+
+		for (; slot + SIMD_LANES <= endSlot; slot += SIMD_LANES)
+		{
+			unsigned mask = nearbyMask(x, y, z, slot, px, py, pz, dist);
+			while (mask)
+			{
+				if (addResult(slot + lowestBit(mask), pResultArray, result, maxResults, pExclude))
+					return true;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+
+	for (; slot < endSlot; slot++)
+	{
+		float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+		if (d <= distance && addResult(slot, pResultArray, result, maxResults, pExclude))
+			return true;
+	}
+	return false;
+}
+
+bool SpherePointFinderCellSorted::scanPatches(int cell, const Vector3 &pt, float distance, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude)
+{
+	for (int slot = mPatchHead[cell]; slot != -1; slot = mPatchNext[slot])
+	{
+		float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+		if (d <= distance && addResult(slot, pResultArray, result, maxResults, pExclude))
+			return true;
+	}
+	return false;
+}
+
+bool SpherePointFinderCellSorted::countRun(int slot, int endSlot, const Vector3 &pt, float distance, int &count, int limit, Agent *pExclude)
+{
+#if defined(SIMD_LANES)
+	if (endSlot - slot >= SIMD_LANES)
+	{
+		const float *x = &mX[0], *y = &mY[0], *z = &mZ[0];
+	#if SIMD_LANES == 16
+		__m512 px = _mm512_set1_ps(pt.x), py = _mm512_set1_ps(pt.y), pz = _mm512_set1_ps(pt.z), dist = _mm512_set1_ps(distance);
+	#elif SIMD_LANES == 8
+		__m256 px = _mm256_set1_ps(pt.x), py = _mm256_set1_ps(pt.y), pz = _mm256_set1_ps(pt.z), dist = _mm256_set1_ps(distance);
+	#else
+		__m128 px = _mm_set1_ps(pt.x), py = _mm_set1_ps(pt.y), pz = _mm_set1_ps(pt.z), dist = _mm_set1_ps(distance);
+	#endif
+
+		for (; slot + SIMD_LANES <= endSlot; slot += SIMD_LANES)
+		{
+			unsigned mask = nearbyMask(x, y, z, slot, px, py, pz, dist);
+			while (mask)
+			{
+				if (addCount(slot + lowestBit(mask), count, limit, pExclude))
+					return true;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+
+	for (; slot < endSlot; slot++)
+	{
+		float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+		if (d <= distance && addCount(slot, count, limit, pExclude))
+			return true;
+	}
+	return false;
+}
+
+bool SpherePointFinderCellSorted::countPatches(int cell, const Vector3 &pt, float distance, int &count, int limit, Agent *pExclude)
+{
+	for (int slot = mPatchHead[cell]; slot != -1; slot = mPatchNext[slot])
+	{
+		float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+		if (d <= distance && addCount(slot, count, limit, pExclude))
+			return true;
+	}
+	return false;
+}
+
+void SpherePointFinderCellSorted::getStats(PointFinderStats & stats)
+{
+	int numCells = (int) mCellCount.size();
+	stats.reset(numCells);
+	for (int cell = 0; cell < numCells; cell++)
+	{
+		stats.addCell(mCellCount[cell]);
+
+		for (int kind = 0; kind < eNumEntityKinds; kind++)
+			stats.numByKind[kind] += KIND_COUNT(cell, kind);
+	}
+}
+
+/**
+ Finds the cells of a face that the search cube [lo, hi] projects to. Returns false if the cube misses the face.
+ **/
+bool SpherePointFinderCellSorted::getFaceRange(int face, const float *lo, const float *hi, int &fU, int &tU, int &fV, int &tV)
+{
+	// find the range of the face's major coordinate within the search cube, flipped for the negative faces
+	int axis = face / 2;
+	float majorLo = (face & 1) ? -hi[axis] : lo[axis];
+	float majorHi = (face & 1) ? -lo[axis] : hi[axis];
+	if (majorHi < MIN_MAJOR_COORDINATE)
+		return false;
+	majorLo = max(majorLo, MIN_MAJOR_COORDINATE);
+
+	// then the range of face coordinates that the cube projects to
+	int a = uAxis[axis], b = vAxis[axis];
+	float uLo = min(lo[a] / majorLo, lo[a] / majorHi);
+	float uHi = max(hi[a] / majorLo, hi[a] / majorHi);
+	float vLo = min(lo[b] / majorLo, lo[b] / majorHi);
+	float vHi = max(hi[b] / majorLo, hi[b] / majorHi);
+	if (uLo > 1 || uHi < -1 || vLo > 1 || vHi < -1)
+		return false;
+
+	fU = toFaceCoordinate(uLo, mFaceSubdivisions);
+	tU = toFaceCoordinate(uHi, mFaceSubdivisions);
+	fV = toFaceCoordinate(vLo, mFaceSubdivisions);
+	tV = toFaceCoordinate(vHi, mFaceSubdivisions);
+	return true;
+}
+
+/**
+ Returns true if any of the cells from firstCell to lastCell has its bit set in the bitmap (mOccupied, or one
+ of mKindOccupied), a word at a time
+ **/
+bool SpherePointFinderCellSorted::isOccupied(const vector<unsigned> & bitmap, int firstCell, int lastCell)
+{
+	int word = firstCell >> 5, lastWord = lastCell >> 5;
+	unsigned firstMask = ~0u << (firstCell & 31);
+	unsigned lastMask = ~0u >> (31 - (lastCell & 31));
+
+	if (word == lastWord)
+		return (bitmap[word] & firstMask & lastMask) != 0;
+
+	if (bitmap[word] & firstMask)
+		return true;
+	while (++word < lastWord)
+		if (bitmap[word])
+			return true;
+	return (bitmap[lastWord] & lastMask) != 0;
+}
+
+int SpherePointFinderCellSorted::getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults, Agent *pAgentToExclude)
+{
+	int result = 0;
+
+	float lo[3] = { pt.x - distance, pt.y - distance, pt.z - distance };
+	float hi[3] = { pt.x + distance, pt.y + distance, pt.z + distance };
+
+	bool hasPatches = mNumSlots > mNumSorted;
+
+	for (int face = 0; face < 6; face++)
+	{
+		int fU, tU, fV, tV;
+		if (! getFaceRange(face, lo, hi, fU, tU, fV, tV))
+			continue;
+
+		for (int v = fV; v <= tV; v++)
+		{
+			// the cells from fU to tU are adjacent, so their sorted entities are one contiguous run
+			int firstCell = CELL_INDEX(face,fU,v);
+			int lastCell = CELL_INDEX(face,tU,v);
+			if (! isOccupied(mOccupied, firstCell, lastCell))
+				continue;
+
+			if (scanRun(mCellStart[firstCell], mCellStart[lastCell + 1], pt, distance, pResultArray, result, maxResults, pAgentToExclude))
+				return result;
+
+			if (! hasPatches)
+				continue;
+
+			for (int cell = firstCell; cell <= lastCell; cell++)
+				if (scanPatches(cell, pt, distance, pResultArray, result, maxResults, pAgentToExclude))
+					return result;
+		}
+	}
+
+	return result;
+}
+
+/**
+ The same search as getNearbyEntities(), but it only counts the entities, and stops at the limit. Rows of cells
+ with no live entities are skipped using the occupancy bitmap, without touching their runs or patch chains.
+ **/
+int SpherePointFinderCellSorted::countWithin(const Vector3 &pt, float distance, int limit, Agent *pExclude)
+{
+	int count = 0;
+	if (limit <= 0)
+		return count;
+
+	float lo[3] = { pt.x - distance, pt.y - distance, pt.z - distance };
+	float hi[3] = { pt.x + distance, pt.y + distance, pt.z + distance };
+
+	bool hasPatches = mNumSlots > mNumSorted;
+
+	for (int face = 0; face < 6; face++)
+	{
+		int fU, tU, fV, tV;
+		if (! getFaceRange(face, lo, hi, fU, tU, fV, tV))
+			continue;
+
+		for (int v = fV; v <= tV; v++)
+		{
+			int firstCell = CELL_INDEX(face,fU,v);
+			int lastCell = CELL_INDEX(face,tU,v);
+			if (! isOccupied(mOccupied, firstCell, lastCell))
+				continue;
+
+			if (countRun(mCellStart[firstCell], mCellStart[lastCell + 1], pt, distance, count, limit, pExclude))
+				return count;
+
+			if (! hasPatches)
+				continue;
+
+			for (int cell = firstCell; cell <= lastCell; cell++)
+				if (mCellCount[cell] && countPatches(cell, pt, distance, count, limit, pExclude))
+					return count;
+		}
+	}
+
+	return count;
+}
+
+unsigned SpherePointFinderCellSorted::getKindsNear(const Vector3 &pt, float distance, unsigned kindMask)
+{
+	unsigned kinds = 0;
+
+	float lo[3] = { pt.x - distance, pt.y - distance, pt.z - distance };
+	float hi[3] = { pt.x + distance, pt.y + distance, pt.z + distance };
+
+	for (int face = 0; face < 6; face++)
+	{
+		int fU, tU, fV, tV;
+		if (! getFaceRange(face, lo, hi, fU, tU, fV, tV))
+			continue;
+
+		for (int v = fV; v <= tV; v++)
+		{
+			int firstCell = CELL_INDEX(face,fU,v);
+			int lastCell = CELL_INDEX(face,tU,v);
+			for (int kind = 0; kind < eNumEntityKinds; kind++)
+				if ((kindMask & ~kinds & ENTITY_KIND_BIT(kind)) && isOccupied(mKindOccupied[kind], firstCell, lastCell))
+					kinds |= ENTITY_KIND_BIT(kind);
+
+			if (kinds == kindMask)
+				return kinds;
+		}
+	}
+
+	return kinds;
+}
+
+/**
+ Returns true if any of the cells from firstCell to lastCell holds an entity of one of the kinds in kindMask
+ **/
+bool SpherePointFinderCellSorted::hasKinds(int firstCell, int lastCell, unsigned kindMask)
+{
+	if (kindMask & ENTITY_KIND_BIT(eEntityOther))
+		return isOccupied(mOccupied, firstCell, lastCell);
+
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		if ((kindMask & ENTITY_KIND_BIT(kind)) && isOccupied(mKindOccupied[kind], firstCell, lastCell))
+			return true;
+	return false;
+}
+
+/**
+ Adds the entity in the slot to the nearest ones found so far if it passes the filters and is within distance.
+ If it's further away, but could still make the list, it's kept in mFarSlots for a later pass
+ **/
+inline void SpherePointFinderCellSorted::addNearest(int slot, float distance, NearestEntities &nearest,
+	unsigned kindMask, Agent *pAgent, entityFilter filter)
+{
+	const Vector3 &pt = nearest.pt;
+	float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+	if (d > nearest.bound || mEntities[slot] == NULL || ! passesFilter(mEntities[slot], kindMask, pAgent, filter))
+		return;
+
+	if (d <= distance)
+		nearest.add(mEntities[slot], d);
+	else
+		mFarSlots.push_back(slot);
+}
+
+/**
+ Passes every entity in the cells from firstCell to lastCell (of one row) to addNearest()
+ **/
+void SpherePointFinderCellSorted::addNearestInCells(int firstCell, int lastCell, float distance, NearestEntities &nearest,
+	unsigned kindMask, Agent *pAgent, entityFilter filter)
+{
+	if (firstCell > lastCell || ! hasKinds(firstCell, lastCell, kindMask))
+		return;
+
+	for (int slot = mCellStart[firstCell]; slot < mCellStart[lastCell + 1]; slot++)
+		addNearest(slot, distance, nearest, kindMask, pAgent, filter);
+
+	if (mNumSlots == mNumSorted)
+		return;
+
+	for (int cell = firstCell; cell <= lastCell; cell++)
+		for (int slot = mPatchHead[cell]; slot != -1; slot = mPatchNext[slot])
+			addNearest(slot, distance, nearest, kindMask, pAgent, filter);
+}
+
+int SpherePointFinderCellSorted::findNearest(const Vector3 &pt, int k, SphereEntity **pResultArray, float maxDistance, unsigned kindMask,
+	Agent *pAgent, entityFilter filter)
+{
+	NearestEntities nearest(pt, pResultArray, k, maxDistance);
+	if (k <= 0)
+		return 0;
+
+	// the cells of each face that the passes so far have scanned (none where scannedFU > scannedTU). A bigger
+	// cube's range of cells never leaves out any of a smaller one's, so the next pass only has to scan the
+	// cells around them
+	int scannedFU[6], scannedTU[6], scannedFV[6], scannedTV[6];
+	for (int face = 0; face < 6; face++) {
+		scannedFU[face] = scannedFV[face] = 0;
+		scannedTU[face] = scannedTV[face] = -1;
+	}
+	mFarSlots.clear();
+
+	// no two points on the sphere are further apart than 2, so a cube that size covers everything
+	float distance = min(FACE_WIDTH / mFaceSubdivisions * NEAREST_START_FRACTION, 2.0f);
+
+	for (;;)
+	{
+		distance = min(distance, min(maxDistance, 2.0f));
+
+		// first the entities that the passes before this one found outside of their cubes
+		int numFar = 0;
+		for (size_t i = 0; i < mFarSlots.size(); i++) {
+			int slot = mFarSlots[i];
+			float d = max(fabsf(pt.x - mX[slot]), max(fabsf(pt.y - mY[slot]), fabsf(pt.z - mZ[slot])));
+			if (d > nearest.bound)
+				continue;
+			if (d <= distance)
+				nearest.add(mEntities[slot], d);
+			else
+				mFarSlots[numFar++] = slot;
+		}
+		mFarSlots.resize(numFar);
+
+		float lo[3] = { pt.x - distance, pt.y - distance, pt.z - distance };
+		float hi[3] = { pt.x + distance, pt.y + distance, pt.z + distance };
+
+		for (int face = 0; face < 6; face++)
+		{
+			int fU, tU, fV, tV;
+			if (! getFaceRange(face, lo, hi, fU, tU, fV, tV))
+				continue;
+
+			for (int v = fV; v <= tV; v++)
+			{
+				// (the cells of a row that have been scanned are together, so what's left is on either side of them)
+				if (v >= scannedFV[face] && v <= scannedTV[face] && scannedFU[face] <= scannedTU[face]) {
+					addNearestInCells(CELL_INDEX(face,fU,v), CELL_INDEX(face,scannedFU[face] - 1,v), distance, nearest, kindMask, pAgent, filter);
+					addNearestInCells(CELL_INDEX(face,scannedTU[face] + 1,v), CELL_INDEX(face,tU,v), distance, nearest, kindMask, pAgent, filter);
+				}
+				else
+					addNearestInCells(CELL_INDEX(face,fU,v), CELL_INDEX(face,tU,v), distance, nearest, kindMask, pAgent, filter);
+			}
+
+			scannedFU[face] = fU;
+			scannedTU[face] = tU;
+			scannedFV[face] = fV;
+			scannedTV[face] = tV;
+		}
+
+		// everything within distance has been seen, so the search is done if the k nearest are within it too
+		if ((nearest.isFull() && nearest.bound <= distance) || distance >= min(maxDistance, 2.0f))
+			break;
+
+		distance *= 2;
+	}
+
+	return nearest.count;
+}
@@ -0,0 +1,135 @@
+//
+//  SpherePointFinderCellSorted.h
+//  MutationPlanet
+//
+//
+
+#ifndef __BioSphere__SpherePointFinderCellSorted__
+#define __BioSphere__SpherePointFinderCellSorted__
+
+#include "gameplay.h"
+#include "SphereEntity.h"
+#include "BaseSpherePointFinder.h"
+#include "Constants.h"
+#include <vector>
+
+using namespace gameplay;
+using namespace std;
+
+// filter the sorted runs several entities at a time with SIMD instructions, when available
+#define SIMD_DISTANCE_FILTER 1
+
+
+class SpherePointFinderCellSorted : public BaseSpherePointFinder {
+public:
+    SpherePointFinderCellSorted();
+
+	void clear();
+    void insert(SphereEntity *);
+    void remove(SphereEntity *);
+    void moveEntity(SphereEntity *, Vector3);
+
+    using BaseSpherePointFinder::getNearbyEntities;
+    int getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults = 16, Agent *pExclude = NULL);
+    int countWithin(const Vector3 &pt, float distance, int limit, Agent *pExclude = NULL);
+    unsigned getKindsNear(const Vector3 &pt, float distance, unsigned kindMask = ALL_ENTITY_KINDS);
+    int findNearest(const Vector3 &pt, int k, SphereEntity **pResultArray, float maxDistance = 2, unsigned kindMask = ANY_ENTITY_KIND,
+                    Agent *pAgent = NULL, entityFilter filter = NULL);
+
+    void setCellSize(float cellSize);
+    void getStats(PointFinderStats & stats);
+
+    // re-sort all entities by cell, folding in the patch list and dropping removed entries. This also
+    // switches to a new resolution if the best one has drifted too far from the current one
+    void rebuild();
+
+    void setResolution(int faceSubdivisions);
+    int getResolution() { return mFaceSubdivisions; }
+
+private:
+    int chooseResolution();
+    int getCellIndex(const Vector3 & v);
+    void sortCells();
+    bool getFaceRange(int face, const float *lo, const float *hi, int &fU, int &tU, int &fV, int &tV);
+    bool isOccupied(const vector<unsigned> & bitmap, int firstCell, int lastCell);
+    void appendSlot(SphereEntity *, int cell);
+    bool scanRun(int slot, int endSlot, const Vector3 &pt, float distance, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude);
+    bool scanPatches(int cell, const Vector3 &pt, float distance, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude);
+    bool countRun(int slot, int endSlot, const Vector3 &pt, float distance, int &count, int limit, Agent *pExclude);
+    bool countPatches(int cell, const Vector3 &pt, float distance, int &count, int limit, Agent *pExclude);
+    bool hasKinds(int firstCell, int lastCell, unsigned kindMask);
+    void addNearest(int slot, float distance, NearestEntities &nearest, unsigned kindMask, Agent *pAgent, entityFilter filter);
+    void addNearestInCells(int firstCell, int lastCell, float distance, NearestEntities &nearest, unsigned kindMask, Agent *pAgent,
+                           entityFilter filter);
+
+    // adds the entity in the slot to the results unless it belongs to the excluded agent; returns true once the results are full
+    inline bool addResult(int slot, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude) {
+        SphereEntity * pEntity = mEntities[slot];
+        if (pExclude == NULL || pExclude != pEntity->mAgent) {
+            pResultArray[result] = pEntity;
+            if (++result >= maxResults)
+                return true;
+        }
+        return false;
+    }
+
+    // counts the entity in the slot unless it belongs to the excluded agent; returns true once the limit is reached
+    inline bool addCount(int slot, int &count, int limit, Agent *pExclude) {
+        return (pExclude == NULL || pExclude != mEntities[slot]->mAgent) && ++count >= limit;
+    }
+
+    // keeps the live counts and occupancy bits of a cell up to date as entities come and go
+    inline void addToCell(int cell, int kind) {
+        if (mCellCount[cell]++ == 0)
+            mOccupied[cell >> 5] |= 1u << (cell & 31);
+        if (kind != eEntityOther && mKindCount[cell * eNumEntityKinds + kind]++ == 0)
+            mKindOccupied[kind][cell >> 5] |= 1u << (cell & 31);
+    }
+
+    inline void removeFromCell(int cell, int kind) {
+        if (--mCellCount[cell] == 0)
+            mOccupied[cell >> 5] &= ~(1u << (cell & 31));
+        if (kind != eEntityOther && --mKindCount[cell * eNumEntityKinds + kind] == 0)
+            mKindOccupied[kind][cell >> 5] &= ~(1u << (cell & 31));
+    }
+
+    // the sorted region: the entities in cell c are in slots [mCellStart[c], mCellStart[c+1])
+    vector<int> mCellStart;
+
+    // the number of live entities in each cell, and a bit per cell that is set while that number is
+    // non zero. Removed entities leave dead slots behind until the next rebuild, so the runs alone can't
+    // tell whether a cell is empty
+    vector<int> mCellCount;
+    vector<unsigned> mOccupied;
+
+    // the same again for each eEntityKind: a count per cell, and a bit per cell set while it is non zero
+    vector<int> mKindCount;
+    vector<unsigned> mKindOccupied[eNumEntityKinds];
+
+    // slots at or past mNumSorted were added since the last rebuild, and are chained per cell
+    vector<int> mPatchHead;
+    vector<int> mPatchNext;
+
+    // per slot data, kept in parallel arrays so that scanning a cell reads sequential memory
+    vector<float> mX, mY, mZ;
+    vector<SphereEntity*> mEntities;
+    vector<int> mCell;
+
+    // scratch arrays for rebuild(), kept around to avoid reallocating them
+    vector<float> mSortX, mSortY, mSortZ;
+    vector<SphereEntity*> mSortEntities;
+    vector<int> mSortCell;
+
+    // scratch for findNearest(): the slots that a pass looked at but found outside its cube, for a later pass
+    vector<int> mFarSlots;
+
+    // the number of cells along each face, and the cell size that it was chosen for
+    int mFaceSubdivisions;
+    float mCellSize;
+
+    int mNumSorted;
+    int mNumSlots;
+    int mNumLive;
+};
+
+#endif /* defined(__BioSphere__SpherePointFinderCellSorted__) */
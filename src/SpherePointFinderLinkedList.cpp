@@ -28,24 +28,129 @@
  A kdtree might be a better option, but this is actually pretty fast. I think the advantage of this
  approach is that when a segment moves within the same subdivision, there's almost no processing that
  needs to happen.
+
+ With MORTON_BUCKET_ORDER, the bucket heads are indexed by interleaving the bits of x, y and z rather
+ than row by row, so a 3x3x3 neighborhood mostly lands in a few nearby cache lines instead of being
+ spread over 2*64*64 pointers.
+
+ The Morton order also gives a coarser level for free: each 4x4x4 block of subdivisions is a run of
+ 64 consecutive indices, which is two words of the occupancy bitmap. Queries go a block at a time,
+ skip the empty ones with a single test, and only visit the occupied subdivisions within range, so a
+ wide query costs about what it finds rather than the volume it covers.
+
+ Each subdivision also keeps a count of the food, barrier and motile segments in it, with a bitmap per
+ kind alongside the occupancy one, so getKindsNear() can answer from the bitmaps alone.
+
+ findNearest() works outwards from the subdivision holding the point, a ring of subdivisions at a time,
+ until nothing beyond the rings searched so far could be nearer than what it has already found.
  **/
 
 #include "SpherePointFinderLinkedList.h"
+#include "UtilsBits.h"
+#include <float.h>
+
+#if MORTON_BUCKET_ORDER
+// spreads the low 10 bits of v out to every third bit. NUM_SUBDIVISIONS must be a power of two for
+// the interleaved indices to exactly fill the bucket array
+static inline int spreadBits(int v)
+{
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
 
+#define ENTITY_INDEX(x,y,z) (spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2))
+
+// blocks are 4 subdivisions across, so a block's first index is its Morton index shifted by 3 * 2 bits
+#define BLOCK_BITS 2
+#define BLOCK_SIZE (1 << BLOCK_BITS)
+
+// for each axis, which of a block's 64 subdivisions have each of the 4 coordinates along that axis
+static const unsigned long long blockCoordinateMask[3][BLOCK_SIZE] = {
+	{ 0x0055005500550055ULL, 0x00AA00AA00AA00AAULL, 0x5500550055005500ULL, 0xAA00AA00AA00AA00ULL },
+	{ 0x0000333300003333ULL, 0x0000CCCC0000CCCCULL, 0x3333000033330000ULL, 0xCCCC0000CCCC0000ULL },
+	{ 0x000000000F0F0F0FULL, 0x00000000F0F0F0F0ULL, 0x0F0F0F0F00000000ULL, 0xF0F0F0F000000000ULL }
+};
+
+// the subdivisions of the block starting at blockStart (along the axis) that are within [from, to]
+static inline unsigned long long blockRangeMask(int axis, int blockStart, int from, int to)
+{
+	from = max(from - blockStart, 0);
+	to = min(to - blockStart, BLOCK_SIZE - 1);
+	if (from == 0 && to == BLOCK_SIZE - 1)
+		return ~0ULL;
+
+	unsigned long long mask = 0;
+	for (int i = from; i <= to; i++)
+		mask |= blockCoordinateMask[axis][i];
+	return mask;
+}
+
+#else
 #define ENTITY_INDEX(x,y,z) (x + y*NUM_SUBDIVISIONS + z*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS)
+#endif
 static inline int toIntCoordinate(float v) { return max(min(NUM_SUBDIVISIONS - 1, int ((v + 1) / 2 * NUM_SUBDIVISIONS + .5f)),0); }
 
+#define NUM_OCCUPIED_WORDS (NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS / 32)
+#define IS_OCCUPIED(i) (mOccupied[(i) >> 5] & (1u << ((i) & 31)))
+#define KIND_COUNT(i,kind) mKindCount[(i) * eNumEntityKinds + (kind)]
+
 #define TRACE_FINDER if(false)TRACE
 
+// the width of a subdivision, and the coordinate where subdivision i starts (see toIntCoordinate)
+#define SUBDIVISION_WIDTH (2.0f / NUM_SUBDIVISIONS)
+#define SUBDIVISION_START(i) (((i) - .5f) * SUBDIVISION_WIDTH - 1)
+
+// allows for rounding when working out which side of a subdivision boundary a coordinate falls
+#define BOUNDARY_SLACK 1.0e-5f
+
 SpherePointFinderLinkedList::SpherePointFinderLinkedList()
 {
 	mSphereEntities = new SphereEntityPtr[NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS];
 	memset(mSphereEntities, 0, sizeof(SphereEntityPtr)*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS);
+	mOccupied = new unsigned[NUM_OCCUPIED_WORDS];
+	memset(mOccupied, 0, sizeof(unsigned)*NUM_OCCUPIED_WORDS);
+	mKindCount = new int[NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*eNumEntityKinds];
+	memset(mKindCount, 0, sizeof(int)*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*eNumEntityKinds);
+	for (int kind = 0; kind < eNumEntityKinds; kind++) {
+		mKindOccupied[kind] = new unsigned[NUM_OCCUPIED_WORDS];
+		memset(mKindOccupied[kind], 0, sizeof(unsigned)*NUM_OCCUPIED_WORDS);
+	}
+}
+
+SpherePointFinderLinkedList::~SpherePointFinderLinkedList()
+{
+	delete[] mSphereEntities;
+	delete[] mOccupied;
+	delete[] mKindCount;
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		delete[] mKindOccupied[kind];
+}
+
+void SpherePointFinderLinkedList::getStats(PointFinderStats & stats)
+{
+	stats.reset(NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS);
+	for (int i = 0; i < NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS; i++)
+	{
+		int count = 0;
+		for (SphereEntity * pEntity = mSphereEntities[i]; pEntity != NULL; pEntity = pEntity->mSphereNext)
+			++count;
+		stats.addCell(count);
+
+		for (int kind = 0; kind < eNumEntityKinds; kind++)
+			stats.numByKind[kind] += KIND_COUNT(i, kind);
+	}
 }
 
 void SpherePointFinderLinkedList::clear()
 {
 	memset(mSphereEntities, 0, sizeof(SphereEntityPtr)*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS);
+	memset(mOccupied, 0, sizeof(unsigned)*NUM_OCCUPIED_WORDS);
+	memset(mKindCount, 0, sizeof(int)*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*NUM_SUBDIVISIONS*eNumEntityKinds);
+	for (int kind = 0; kind < eNumEntityKinds; kind++)
+		memset(mKindOccupied[kind], 0, sizeof(unsigned)*NUM_OCCUPIED_WORDS);
 }
 
 void SpherePointFinderLinkedList:: insert(SphereEntity * pEntity)
@@ -65,6 +170,11 @@ void SpherePointFinderLinkedList:: insert(SphereEntity * pEntity)
 		pEntity->mSphereNext->mSpherePrev = pEntity;
 	}
 	mSphereEntities[entityIndex] = pEntity;
+	mOccupied[entityIndex >> 5] |= 1u << (entityIndex & 31);
+
+	int kind = getEntityKind(pEntity->mType);
+	if (kind != eEntityOther && KIND_COUNT(entityIndex, kind)++ == 0)
+		mKindOccupied[kind][entityIndex >> 5] |= 1u << (entityIndex & 31);
 
 	pEntity->mInserted = true;
 
@@ -88,7 +198,15 @@ void SpherePointFinderLinkedList:: remove(SphereEntity * pEntity)
 	SphereEntity * pPrev = pEntity->mSpherePrev;
 
 	if (mSphereEntities[entityIndex] == pEntity)
+	{
 		mSphereEntities[entityIndex] = pNext;
+		if (pNext == NULL)
+			mOccupied[entityIndex >> 5] &= ~(1u << (entityIndex & 31));
+	}
+
+	int kind = getEntityKind(pEntity->mType);
+	if (kind != eEntityOther && --KIND_COUNT(entityIndex, kind) == 0)
+		mKindOccupied[kind][entityIndex >> 5] &= ~(1u << (entityIndex & 31));
 
 	if (pNext != NULL)
 		pNext->mSpherePrev = pPrev;
@@ -122,12 +240,47 @@ void SpherePointFinderLinkedList:: moveEntity(SphereEntity * pEntity, Vector3 ne
 	HEAPCHECK;
 }
 
-int SpherePointFinderLinkedList::getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults, Agent *pAgentToExclude)
+/**
+ Gathers the entities in one subdivision that are within distance of the point into pResultArray, or
+ just counts them if it is NULL. Returns true once the results are full.
+ **/
+bool SpherePointFinderLinkedList::searchSubdivision(int entityIndex, const Vector3 &pt, float distance, SphereEntity **pResultArray,
+	int &result, int maxResults, Agent *pAgentToExclude)
 {
-	HEAPCHECK;
+	SphereEntityPtr pEntity = mSphereEntities[entityIndex];
+	while (pEntity != NULL) {
+
+		if (pAgentToExclude == NULL || pAgentToExclude != pEntity->mAgent) {
+			float d = calcDistance(pt, pEntity->mLocation);
+			if (d <= distance)
+			{
+				if (pResultArray)
+					pResultArray[result] = pEntity;
+				++result;
+				TRACE_FINDER("included (%f,%f,%f), distance = %f, result count = %d\n",
+					pEntity->mLocation.x, pEntity->mLocation.y, pEntity->mLocation.z, d, result);
+
+				if (result >= maxResults)
+					return true;
+			}
+			else {
+				TRACE_FINDER("excluded (%f,%f,%f), distance = %f\n", pEntity->mLocation.x, pEntity->mLocation.y, pEntity->mLocation.z, d);
+			}
+		}
+		pEntity = pEntity->mSphereNext;
+	}
+	return false;
+}
 
+/**
+ The search behind getNearbyEntities() and countWithin()
+ **/
+int SpherePointFinderLinkedList::search(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults, Agent *pAgentToExclude)
+{
 	int result = 0;
-    
+	if (maxResults <= 0)
+		return result;
+
     // detemine the cube to search
         
     int fX = toIntCoordinate(pt.x - distance);
@@ -137,38 +290,200 @@ int SpherePointFinderLinkedList::getNearbyEntities(const Vector3 &pt, float dist
     int fZ = toIntCoordinate(pt.z - distance);
     int tZ = toIntCoordinate(pt.z + distance);
 
+#if MORTON_BUCKET_ORDER
+	for (int bX = fX >> BLOCK_BITS; bX <= tX >> BLOCK_BITS; bX++)
+		for (int bY = fY >> BLOCK_BITS; bY <= tY >> BLOCK_BITS; bY++)
+			for (int bZ = fZ >> BLOCK_BITS; bZ <= tZ >> BLOCK_BITS; bZ++)
+			{
+				int blockIndex = ENTITY_INDEX(bX,bY,bZ) << (3 * BLOCK_BITS);
+				unsigned long long occupied = mOccupied[blockIndex >> 5] | ((unsigned long long) mOccupied[(blockIndex >> 5) + 1] << 32);
+				if (occupied == 0)
+					continue;
+
+				occupied &= blockRangeMask(0, bX << BLOCK_BITS, fX, tX) & blockRangeMask(1, bY << BLOCK_BITS, fY, tY) &
+					blockRangeMask(2, bZ << BLOCK_BITS, fZ, tZ);
+
+				for (int half = 0; half < 2; half++)
+				{
+					unsigned bits = (unsigned) (occupied >> (32 * half));
+					while (bits)
+					{
+						if (searchSubdivision(blockIndex + 32 * half + lowestBit(bits), pt, distance, pResultArray, result, maxResults, pAgentToExclude))
+							return result;
+						bits &= bits - 1;
+					}
+				}
+			}
+#else
     for (int x = fX; x <= tX; x++)
         for (int y = fY; y <= tY; y++)
             for (int z = fZ; z <= tZ; z++)
             {
 				int entityIndex = ENTITY_INDEX(x,y,z);
-				SphereEntityPtr pEntity = mSphereEntities[entityIndex];
-				while (pEntity != NULL) {
-                
-					if (pAgentToExclude == NULL || pAgentToExclude != pEntity->mAgent) {                    
-						float d = calcDistance(pt, pEntity->mLocation);
-						if (d <= distance)
-						{
-							*pResultArray++ = pEntity;
-							++result;
-							TRACE_FINDER("included (%f,%f,%f), distance = %f, result count = %d\n",
-								pEntity->mLocation.x, pEntity->mLocation.y, pEntity->mLocation.z, d, result);
-                        
-							if (result >= maxResults) {
-								HEAPCHECK;
-								return result;
-							}
-						}
-						else {
-							TRACE_FINDER("excluded (%f,%f,%f), distance = %f\n", pEntity->mLocation.x, pEntity->mLocation.y, pEntity->mLocation.z, d);
-						}
-					}
-					pEntity = pEntity->mSphereNext;
-                }
+				if (IS_OCCUPIED(entityIndex) && searchSubdivision(entityIndex, pt, distance, pResultArray, result, maxResults, pAgentToExclude))
+					return result;
             }
+#endif
+
+	return result;
+}
+
+int SpherePointFinderLinkedList::getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults, Agent *pAgentToExclude)
+{
+	HEAPCHECK;
+
+	int result = search(pt, distance, pResultArray, maxResults, pAgentToExclude);
 
-    
 	HEAPCHECK;
 
 	return result;
 }
+
+int SpherePointFinderLinkedList::countWithin(const Vector3 &pt, float distance, int limit, Agent *pAgentToExclude)
+{
+	return search(pt, distance, NULL, limit, pAgentToExclude);
+}
+
+/**
+ Checks the kind bitmaps over the search cube, the same way search() checks the occupancy one
+ **/
+unsigned SpherePointFinderLinkedList::getKindsNear(const Vector3 &pt, float distance, unsigned kindMask)
+{
+	unsigned kinds = 0;
+
+	int fX = toIntCoordinate(pt.x - distance);
+	int tX = toIntCoordinate(pt.x + distance);
+	int fY = toIntCoordinate(pt.y - distance);
+	int tY = toIntCoordinate(pt.y + distance);
+	int fZ = toIntCoordinate(pt.z - distance);
+	int tZ = toIntCoordinate(pt.z + distance);
+
+#if MORTON_BUCKET_ORDER
+	for (int bX = fX >> BLOCK_BITS; bX <= tX >> BLOCK_BITS; bX++)
+		for (int bY = fY >> BLOCK_BITS; bY <= tY >> BLOCK_BITS; bY++)
+			for (int bZ = fZ >> BLOCK_BITS; bZ <= tZ >> BLOCK_BITS; bZ++)
+			{
+				int word = ENTITY_INDEX(bX,bY,bZ) << (3 * BLOCK_BITS - 5);
+				if ((mOccupied[word] | mOccupied[word + 1]) == 0)
+					continue;
+
+				unsigned long long inRange = blockRangeMask(0, bX << BLOCK_BITS, fX, tX) & blockRangeMask(1, bY << BLOCK_BITS, fY, tY) &
+					blockRangeMask(2, bZ << BLOCK_BITS, fZ, tZ);
+
+				for (int kind = 0; kind < eNumEntityKinds; kind++)
+				{
+					unsigned *pBits = mKindOccupied[kind];
+					if ((kindMask & ENTITY_KIND_BIT(kind)) && ((pBits[word] | ((unsigned long long) pBits[word + 1] << 32)) & inRange))
+						kinds |= ENTITY_KIND_BIT(kind);
+				}
+
+				if (kinds == kindMask)
+					return kinds;
+			}
+#else
+	for (int x = fX; x <= tX; x++)
+		for (int y = fY; y <= tY; y++)
+			for (int z = fZ; z <= tZ; z++)
+			{
+				int entityIndex = ENTITY_INDEX(x,y,z);
+				if (! IS_OCCUPIED(entityIndex))
+					continue;
+
+				for (int kind = 0; kind < eNumEntityKinds; kind++)
+					if ((kindMask & ENTITY_KIND_BIT(kind)) && KIND_COUNT(entityIndex, kind))
+						kinds |= ENTITY_KIND_BIT(kind);
+
+				if (kinds == kindMask)
+					return kinds;
+			}
+#endif
+
+	return kinds;
+}
+
+/**
+ Adds the entities in one subdivision that pass the filters to the nearest ones found so far
+ **/
+void SpherePointFinderLinkedList::addNearest(int entityIndex, NearestEntities &nearest, unsigned kindMask, Agent *pAgent, entityFilter filter)
+{
+	if (! IS_OCCUPIED(entityIndex))
+		return;
+
+	// skip the subdivision without touching its entities if it has none of the kinds asked for
+	if (! (kindMask & ENTITY_KIND_BIT(eEntityOther)))
+	{
+		bool hasKind = false;
+		for (int kind = 0; kind < eNumEntityKinds && ! hasKind; kind++)
+			hasKind = (kindMask & ENTITY_KIND_BIT(kind)) && KIND_COUNT(entityIndex, kind);
+		if (! hasKind)
+			return;
+	}
+
+	for (SphereEntity * pEntity = mSphereEntities[entityIndex]; pEntity != NULL; pEntity = pEntity->mSphereNext)
+	{
+		float d = calcDistance(nearest.pt, pEntity->mLocation);
+		if (d <= nearest.bound && passesFilter(pEntity, kindMask, pAgent, filter))
+			nearest.add(pEntity, d);
+	}
+}
+
+int SpherePointFinderLinkedList::findNearest(const Vector3 &pt, int k, SphereEntity **pResultArray, float maxDistance, unsigned kindMask,
+	Agent *pAgent, entityFilter filter)
+{
+	NearestEntities nearest(pt, pResultArray, k, maxDistance);
+	if (k <= 0)
+		return 0;
+
+	int c[3] = { toIntCoordinate(pt.x), toIntCoordinate(pt.y), toIntCoordinate(pt.z) };
+	float p[3] = { pt.x, pt.y, pt.z };
+
+	for (int ring = 0; ; ring++)
+	{
+		// the subdivisions within this ring along each axis, clipped to the grid
+		int from[3], to[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			from[axis] = max(c[axis] - ring, 0);
+			to[axis] = min(c[axis] + ring, NUM_SUBDIVISIONS - 1);
+		}
+
+		for (int x = from[0]; x <= to[0]; x++)
+		{
+			bool onX = abs(x - c[0]) == ring;
+			for (int y = from[1]; y <= to[1]; y++)
+			{
+				if (onX || abs(y - c[1]) == ring)
+				{
+					// on a face of the ring, so take the whole row
+					for (int z = from[2]; z <= to[2]; z++)
+						addNearest(ENTITY_INDEX(x,y,z), nearest, kindMask, pAgent, filter);
+				}
+				else
+				{
+					// inside it, so only the ends of the row are on the ring
+					if (c[2] - ring >= 0)
+						addNearest(ENTITY_INDEX(x,y,c[2] - ring), nearest, kindMask, pAgent, filter);
+					if (ring > 0 && c[2] + ring < NUM_SUBDIVISIONS)
+						addNearest(ENTITY_INDEX(x,y,c[2] + ring), nearest, kindMask, pAgent, filter);
+				}
+			}
+		}
+
+		// anything not searched yet is outside the rings so far along some axis, so it can be no nearer
+		// than the nearest of their sides (ignoring those at the edge of the grid, which have nothing beyond)
+		float unsearched = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (c[axis] - ring > 0)
+				unsearched = min(unsearched, p[axis] - SUBDIVISION_START(c[axis] - ring));
+			if (c[axis] + ring < NUM_SUBDIVISIONS - 1)
+				unsearched = min(unsearched, SUBDIVISION_START(c[axis] + ring + 1) - p[axis]);
+		}
+		unsearched -= BOUNDARY_SLACK;
+
+		if (unsearched > nearest.bound || (nearest.isFull() && unsearched >= nearest.bound))
+			break;
+	}
+
+	return nearest.count;
+}
@@ -11,30 +11,49 @@
 
 #include "gameplay.h"
 #include "SphereEntity.h"
+#include "BaseSpherePointFinder.h"
 #include "constants.h"
 #include <set>
 
 using namespace gameplay;
 using namespace std;
 
+// lay the buckets out along a Morton curve, so that neighboring buckets are usually close in memory
+#define MORTON_BUCKET_ORDER 1
 
-class SpherePointFinderLinkedList{
+class SpherePointFinderLinkedList : public BaseSpherePointFinder {
 public:
     SpherePointFinderLinkedList();
+    ~SpherePointFinderLinkedList();
     
 	void clear();
     void insert(SphereEntity *);
     void remove(SphereEntity *);
     void moveEntity(SphereEntity *, Vector3);
 
+    using BaseSpherePointFinder::getNearbyEntities;
     int getNearbyEntities(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults = 16, Agent *pExclude = NULL);
+    int countWithin(const Vector3 &pt, float distance, int limit, Agent *pExclude = NULL);
+    unsigned getKindsNear(const Vector3 &pt, float distance, unsigned kindMask = ALL_ENTITY_KINDS);
+    int findNearest(const Vector3 &pt, int k, SphereEntity **pResultArray, float maxDistance = 2, unsigned kindMask = ANY_ENTITY_KIND,
+                    Agent *pAgent = NULL, entityFilter filter = NULL);
 
-    int getNearbyEntities(SphereEntity * pNearEntity, float distance, SphereEntity **pResultArray, int maxResults = 16) {
-        return getNearbyEntities(pNearEntity->mLocation, distance, pResultArray, maxResults, pNearEntity->mAgent);
-    }
+    void getStats(PointFinderStats & stats);
 
 private:
+    int search(const Vector3 &pt, float distance, SphereEntity **pResultArray, int maxResults, Agent *pExclude);
+    bool searchSubdivision(int entityIndex, const Vector3 &pt, float distance, SphereEntity **pResultArray, int &result, int maxResults, Agent *pExclude);
+    void addNearest(int entityIndex, NearestEntities &nearest, unsigned kindMask, Agent *pAgent, entityFilter filter);
+
     SphereEntityPtr *mSphereEntities;
+
+    // a bit per subdivision, set while its list is non empty. At 32k it stays in cache, unlike the 2MB of
+    // list heads, so the empty subdivisions around a query cost almost nothing
+    unsigned *mOccupied;
+
+    // the number of entities of each eEntityKind in each subdivision, and a bitmap per kind like mOccupied
+    int *mKindCount;
+    unsigned *mKindOccupied[eNumEntityKinds];
 };
 
 #endif /* defined(__BioSphere__SpherePointFinderSpaceDivison__) */
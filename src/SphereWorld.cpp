@@ -27,7 +27,14 @@
 #include "Agent.h"
 #include "UtilsRandom.h"
 #include "SpherePointFinderLinkedList.h"
+#include "SpherePointFinderCellSorted.h"
 #include "Parameters.h"
+#include "UtilsBits.h"
+#include <time.h>
+#include <limits.h>
+
+// mSweepIndex when step() isn't going through the agents, above every agent's index
+#define NOT_SWEEPING INT_MAX
 
 template<class V>
 void writeBinary(V v, ostream & out)
@@ -91,75 +98,262 @@ void readMap(std::map<K,V> & m, istream & in) {
     }
 }
 
-static SpherePointFinderLinkedList spherePointFinder;
-//static BaseSpherePointFinder * pSpherePointFinder = NULL;
-static SphereWorld * pInstance = NULL;
+static BaseSpherePointFinder * createPointFinder(ePointFinder pointFinder)
+{
+    switch (pointFinder) {
+        case ePointFinderLinkedList:
+            return new SpherePointFinderLinkedList();
+        default:
+            return new SpherePointFinderCellSorted();
+    }
+}
 
 
 SphereWorld::SphereWorld()
 {
-    if (pInstance)
-        throw "already inited";
-
-//    pSpherePointFinder = new SpherePointFinderLinkedList();
+    mPointFinderType = DEFAULT_POINT_FINDER;
+    mPointFinder = createPointFinder(mPointFinderType);
+    mNumPruned = mNumPrunedAtSample = 0;
 
     mMaxLiveAgentIndex = -1;
     mNumAgents = 0;
+    mMaxAgents = MAX_AGENTS;
 	mAllowFollow = false;
+	mTopCritterIndex = -1;
     mCurrentTurn = 0;
 	mNumSegments = 0;
+    mSweepIndex = NOT_SWEEPING;
+    mSegmentsBehindSweep = 0;
+    mParkedSpeed = -1;
+    mParkedPhotosynthesizeBonus = 0;
+    mNoSegments.mWorld = this;
     
-    for (int i = 0; i < MAX_AGENTS; i++)
-    {
-        mAgents[i].mSegments = &this->mEntites[i*MAX_SEGMENTS];
-    }
-    
-    pInstance = this;
+    // (the agents are allocated as they're needed, see requestFreeAgentSlot())
+    rebuildSlotLists();
+}
+
+SphereWorld::~SphereWorld()
+{
+    delete mPointFinder;
 }
 
 void SphereWorld :: clear()
 {
-    for (int i = 0; i < MAX_AGENTS; i++)
+    // (going backwards, as killing an agent moves the last one into its place)
+    for (int n = (int) mLiveAgents.size() - 1; n >= 0; n--)
     {
-        Agent & agent = mAgents[i];
-        if (agent.mStatus == eAlive)
+        int i = mLiveAgents[n];
+        if (mAgents[i].mStatus == eAlive)
             killAgent(i);
     }
 	mNumAgents = mMaxLiveAgentIndex = 0;
+	mTopCritterIndex = -1;
     mCurrentTurn = 0;
-#if LL_FREE_SLOTS
-#else
-	mFreeSlots.clear();
-#endif
+	rebuildSlotLists();
 	
-    mChildToParentGenomes.clear();
-    mGenomeToFirstTurn.clear();
+    mPhylogeny.clear();
 }
 
 
 /**
- get a nonexistent entity, or -1 if none are available
+ Marks every nonexistent agent's slot as free, and lists every other agent as being in the world (and awake)
+ **/
+void SphereWorld :: rebuildSlotLists()
+{
+    mFreeSlots.assign(mFreeSlots.size(), 0);
+    mFreeSlotWords.assign(mFreeSlotWords.size(), 0);
+    mAwakeSlots.assign(mAwakeSlots.size(), 0);
+    mParkedSlots.assign(mParkedSlots.size(), 0);
+    mScheduler.clear(mCurrentTurn);
+    mParkedSegments = 0;
+    mLiveAgents.clear();
+    for (int i = 0; i < mAgents.getCapacity(); i++)
+    {
+        if (mAgents[i].mStatus == eNonExistent) {
+            setSlotFree(i);
+            mLivePosition[i] = -1;
+        }
+        else {
+            mLivePosition[i] = (int) mLiveAgents.size();
+            mLiveAgents.push_back(i);
+            mAwakeSlots[i >> 5] |= 1u << (i & 31);
+        }
+    }
+}
+
+/**
+ Allocates another chunk of agents, and makes room for them in everything indexed by agent. The new
+ slots are all free, and above all of the others
+ **/
+void SphereWorld :: growAgents()
+{
+    int firstNewAgent = mAgents.getCapacity();
+    mAgents.grow(&mNoSegments);
+
+    int capacity = mAgents.getCapacity();
+    int numWords = (capacity + 31) >> 5;
+    mFreeSlots.resize(numWords, 0);
+    mFreeSlotWords.resize((numWords + 31) >> 5, 0);
+    mAwakeSlots.resize(numWords, 0);
+    mParkedSlots.resize(numWords, 0);
+    mCountedSlots.resize(numWords, 0);
+
+    mLivePosition.resize(capacity, -1);
+    mSettledTurn.resize(capacity, 0);
+    mAgentSpecies.resize(capacity, -1);
+    mAgentProgram.resize(capacity, -1);
+    mScheduler.setCapacity(capacity);
+
+    for (int i = firstNewAgent; i < capacity; i++)
+        setSlotFree(i);
+}
+
+/**
+ Takes the agent off the list of agents in the world, by moving the last one into its place
+ **/
+void SphereWorld :: removeLiveAgent(int index)
+{
+    int position = mLivePosition[index];
+    if (position == -1)
+        return;
+
+    int last = mLiveAgents.back();
+    mLiveAgents[position] = last;
+    mLivePosition[last] = position;
+    mLiveAgents.pop_back();
+
+    mLivePosition[index] = -1;
+    mAwakeSlots[index >> 5] &= ~(1u << (index & 31));
+}
+
+/**
+ Called as step() reaches an agent. If it would do nothing this turn and for some turns to come but count
+ down mDormant or sleep, or be skipped for being near a pole, it is parked until the turn on which it does
+ something, and isn't stepped until then. Returns true if it was parked
+ **/
+bool SphereWorld :: parkAgent(int index)
+{
+    Agent & agent = mAgents[index];
+    if (agent.getWasEaten() || agent.mNumSegments == 0)
+        return false;
+
+    if (agent.mDormant < 0)
+        mScheduler.scheduleForever(index);
+    else {
+        // (its step for this turn hasn't been taken yet)
+        long wakeTurn = mCurrentTurn - 1 + agent.getTurnsUntilAwake(mParkedSpeed, mParkedPhotosynthesizeBonus);
+        if (wakeTurn <= mCurrentTurn)
+            return false;
+        mScheduler.schedule(index, wakeTurn);
+    }
+
+    mSettledTurn[index] = mCurrentTurn - 1;
+    mAwakeSlots[index >> 5] &= ~(1u << (index & 31));
+    mParkedSlots[index >> 5] |= 1u << (index & 31);
+    mParkedSegments += agent.mNumSegments;
+    return true;
+}
+
+/**
+ Takes a parked agent out of the scheduler. Its segments stop being counted as parked, so if step() has
+ already gone past it this turn, they are counted here instead (as they would have been if it had been stepped)
+ **/
+void SphereWorld :: unparkAgent(int index)
+{
+    mScheduler.unschedule(index);
+    mParkedSlots[index >> 5] &= ~(1u << (index & 31));
+    mParkedSegments -= mAgents[index].mNumSegments;
+    if (index < mSweepIndex)
+        mSegmentsBehindSweep += mAgents[index].mNumSegments;
+}
+
+/**
+ Brings a parked agent up to date, as if it had been stepped on every turn through the given one
+ **/
+void SphereWorld :: settleAgent(int index, long throughTurn)
+{
+    int numTurns = (int) (throughTurn - mSettledTurn[index]);
+    if (numTurns > 0) {
+        mAgents[index].skipIdleTurns(numTurns, mParkedSpeed, mParkedPhotosynthesizeBonus);
+        mSettledTurn[index] = throughTurn;
+    }
+}
+
+/**
+ Brings a parked agent up to date for another agent to look at, leaving it parked. If step() has already gone
+ past it this turn, it has had this turn's step
+ **/
+void SphereWorld :: catchUpAgent(int agentIndex)
+{
+    if (mParkedSlots[agentIndex >> 5] & (1u << (agentIndex & 31)))
+        settleAgent(agentIndex, agentIndex < mSweepIndex ? mCurrentTurn : mCurrentTurn - 1);
+}
+
+/**
+ Steps a parked agent again from now on, for when something other than time has woken it (it has been
+ bitten or eaten)
+ **/
+void SphereWorld :: wakeAgent(int agentIndex)
+{
+    if ((mParkedSlots[agentIndex >> 5] & (1u << (agentIndex & 31))) == 0)
+        return;
+
+    catchUpAgent(agentIndex);
+    unparkAgent(agentIndex);
+    mAwakeSlots[agentIndex >> 5] |= 1u << (agentIndex & 31);
+}
+
+/**
+ Wakes every parked agent, for when the parameters they were parked under change
+ **/
+void SphereWorld :: wakeParkedAgents()
+{
+    for (int word = 0; word < (int) mParkedSlots.size(); word++) {
+        for (unsigned bits = mParkedSlots[word]; bits; bits &= bits - 1)
+            wakeAgent((word << 5) + lowestBit(bits));
+    }
+}
+
+/**
+ The highest index of a parked agent, or -1
+ **/
+int SphereWorld :: getLastParkedIndex()
+{
+    for (int word = (int) mParkedSlots.size() - 1; word >= 0; word--) {
+        unsigned bits = mParkedSlots[word];
+        if (bits) {
+            int bit = 31;
+            while ((bits & (1u << bit)) == 0)
+                --bit;
+            return (word << 5) + bit;
+        }
+    }
+    return -1;
+}
+
+/**
+ get a nonexistent entity, or -1 if none are available. This is always the lowest free slot, which keeps
+ the live agents packed towards the start of mAgents. If every slot is taken, mAgents grows
  */
 int SphereWorld :: requestFreeAgentSlot()
 {
-    if (mNumAgents == MAX_AGENTS)
+    if (mNumAgents >= mMaxAgents)
         return -1;
     
-    int result;
-#if LL_FREE_SLOTS
-#else
-    if (mFreeSlots.size())
-    {
-        result = *(mFreeSlots.begin());
-        mFreeSlots.erase(result);
-    }
-    else
-#endif
-    {
-        for (result = 0; result < MAX_AGENTS; result++)
-            if (mAgents[result].mStatus == eNonExistent)
-                break;
+    int summary = 0;
+    while (summary < (int) mFreeSlotWords.size() && mFreeSlotWords[summary] == 0)
+        ++summary;
+    if (summary == (int) mFreeSlotWords.size()) {
+        growAgents();
+        summary = (mAgents.getCapacity() - AGENT_CHUNK_SIZE) >> 10;
     }
+
+    int word = (summary << 5) + lowestBit(mFreeSlotWords[summary]);
+    int result = (word << 5) + lowestBit(mFreeSlots[word]);
+
+    mFreeSlots[word] &= mFreeSlots[word] - 1;
+    if (mFreeSlots[word] == 0)
+        mFreeSlotWords[summary] &= ~(1u << (word & 31));
     
     if (result > mMaxLiveAgentIndex)
         mMaxLiveAgentIndex = result;
@@ -168,7 +362,7 @@ int SphereWorld :: requestFreeAgentSlot()
 }
 
 void SphereWorld :: reserveAgentCount(int numAgents) {
-    while ((mNumAgents + numAgents) >= MAX_AGENTS) {
+    while ((mNumAgents + numAgents) >= mMaxAgents) {
         for (int i = 0; i < mMaxLiveAgentIndex; i++)
         {
             if (mAgents[i].mStatus == eAlive)
@@ -186,7 +380,7 @@ void SphereWorld :: reserveAgentCount(int numAgents) {
  **/
 Agent * SphereWorld :: createEmptyAgent(bool killIfNecessary /* = true */)
 {
-    if (killIfNecessary && mNumAgents >= MAX_AGENTS)
+    if (killIfNecessary && mNumAgents >= mMaxAgents)
     {
         reserveAgentCount(1);
     }
@@ -202,14 +396,112 @@ Agent * SphereWorld :: createEmptyAgent(bool killIfNecessary /* = true */)
     return pResult;
 }
 
+/**
+ Gives the agent the species and program of its genome (see GenomePrograms), letting go of any it had
+ **/
+GenomeProgram & SphereWorld :: setAgentGenome(int agentIndex, const char *pGenome)
+{
+    int species = mSpecies.intern(pGenome);
+    int program = mPrograms.acquire(species, pGenome);
+    mSpecies.addReference(species);
+    if (mAgentProgram[agentIndex] != -1) {
+        mPrograms.release(mAgentProgram[agentIndex]);
+        mSpecies.removeReference(mAgentSpecies[agentIndex]);
+        removeSpeciesIfUnused(mAgentSpecies[agentIndex]);
+    }
+    mAgentSpecies[agentIndex] = species;
+    mAgentProgram[agentIndex] = program;
+    return mPrograms.get(program);
+}
+
+/**
+ Gives the agent a run of segments from mSegmentArena, letting go of any it had. They're set up to belong
+ to it and to the world, but are otherwise as their last agent left them
+ **/
+void SphereWorld :: allocateSegments(int agentIndex, int numSegments)
+{
+    Agent & agent = mAgents[agentIndex];
+    releaseSegments(agentIndex);
+    agent.mSegments = mSegmentArena.allocate(numSegments);
+    for (int i = 0; i < numSegments; i++) {
+        agent.mSegments[i].mAgent = &agent;
+        agent.mSegments[i].mWorld = this;
+    }
+}
+
+void SphereWorld :: releaseSegments(int agentIndex)
+{
+    Agent & agent = mAgents[agentIndex];
+    if (agent.mSegments != &mNoSegments) {
+        mSegmentArena.release(agent.mSegments, agent.mNumSegments);
+        agent.mSegments = &mNoSegments;
+    }
+}
+
 /**
  Add the agent by registering its segments
  **/
-void SphereWorld :: addAgentToWorld(Agent *pAgent)
+void SphereWorld :: addAgentToWorld(Agent *pAgent, eStatus status /* = eAlive */)
 {
     for (int i = 0; i < pAgent->mNumSegments; i++)
         registerEntity(&pAgent->mSegments[i]);
-    pAgent->mStatus = eAlive;
+    pAgent->mStatus = status;
+
+    int index = pAgent->mIndex;
+    if (mLivePosition[index] == -1) {
+        mLivePosition[index] = (int) mLiveAgents.size();
+        mLiveAgents.push_back(index);
+        mAwakeSlots[index >> 5] |= 1u << (index & 31);
+    }
+    updateSpeciesCount(index);
+}
+
+/**
+ Counts the agent in its species' count if it's alive and isn't food waiting to sprout, and
+ doesn't if not. This has to be called whenever either of those changes
+ **/
+void SphereWorld :: updateSpeciesCount(int agentIndex)
+{
+    Agent & agent = mAgents[agentIndex];
+    bool isCounted = (mCountedSlots[agentIndex >> 5] & (1u << (agentIndex & 31))) != 0;
+    if (isCounted == (agent.mStatus == eAlive && agent.mSleep != -1))
+        return;
+
+    int species = mAgentSpecies[agentIndex];
+    mCountedSlots[agentIndex >> 5] ^= 1u << (agentIndex & 31);
+    if (isCounted) {
+        mSpecies.removeFromCount(species);
+        if (mSpecies.getCount(species) == 0)
+            pruneExtinctLineage(species);
+    }
+    else {
+        mSpecies.addToCount(species);
+        if (mSpecies.getCount(species) == 1)
+            mPhylogeny.addLiving(species);
+    }
+}
+
+/**
+ Takes the lineages that died out with the species' last living agent out of the family tree, and
+ removes the species that are left with no use
+ **/
+void SphereWorld :: pruneExtinctLineage(int species)
+{
+    mNumPruned += mPhylogeny.removeLiving(species, mReleasedSpecies);
+    for (size_t i = 0; i < mReleasedSpecies.size(); i++)
+        removeSpeciesIfUnused(mReleasedSpecies[i]);
+    mReleasedSpecies.clear();
+}
+
+/**
+ Removes a species that no agent is using and that isn't in the family tree, so that its ID can be reused
+ **/
+void SphereWorld :: removeSpeciesIfUnused(int species)
+{
+    if (mSpecies.isUnreferenced(species) && !mPhylogeny.isInTree(species) && !mPhylogeny.hasChildren(species)) {
+        mPhylogeny.forget(species);
+        mSpecies.remove(species);
+    }
 }
 
 /**
@@ -226,27 +518,62 @@ void SphereWorld :: killAgent(int agentIndex)
         throw "attempt to kill non-existent agent";
     
     Agent & agent = mAgents[agentIndex];
+    if (mParkedSlots[agentIndex >> 5] & (1u << (agentIndex & 31)))
+        unparkAgent(agentIndex);
     for (int i = 0; i < agent.mNumSegments; i++)
         unregisterEntity(&agent.mSegments[i]);
+    releaseSegments(agentIndex);
     agent.mStatus = eNonExistent;
-	
-#if LL_FREE_SLOTS
-#else
-	mFreeSlots.insert(agentIndex);
-#endif
+    updateSpeciesCount(agentIndex);
+    if (mAgentProgram[agentIndex] != -1) {
+        int species = mAgentSpecies[agentIndex];
+        mPrograms.release(mAgentProgram[agentIndex]);
+        mAgentSpecies[agentIndex] = mAgentProgram[agentIndex] = -1;
+        mSpecies.removeReference(species);
+        removeSpeciesIfUnused(species);
+    }
+	setSlotFree(agentIndex);
+	removeLiveAgent(agentIndex);
 	
     --mNumAgents;
 }
 
 /**
  Give all the agents in the world a chance to process. Also determines the highest
- live index (note that requestFreeAgentSlot() sets this as well)
+ live index (note that requestFreeAgentSlot() sets this as well).
+
+ Agents that have nothing to do for a while (being dormant or asleep, or near a pole) are parked rather
+ than stepped (see parkAgent()), and are caught up and stepped again on the turn they wake. While parked
+ they can't become the top critter.
  **/
 int SphereWorld :: step()
 {
     ++mCurrentTurn;
+    mSweepIndex = -1;
+    mSegmentsBehindSweep = 0;
+
+    // the parked agents are caught up with the parameters they were parked under, so they're all woken if those change
+    if (Parameters::instance.speed != mParkedSpeed || Parameters::instance.getPhotosynthesizeBonus() != mParkedPhotosynthesizeBonus) {
+        wakeParkedAgents();
+        mParkedSpeed = Parameters::instance.speed;
+        mParkedPhotosynthesizeBonus = Parameters::instance.getPhotosynthesizeBonus();
+    }
+
+    // wake the agents that are due this turn, with everything but this turn's step done
+    mDueAgents.clear();
+    mScheduler.advance(mDueAgents);
+    for (size_t n = 0; n < mDueAgents.size(); n++) {
+        int i = mDueAgents[n];
+        settleAgent(i, mCurrentTurn - 1);
+        unparkAgent(i);
+        mAwakeSlots[i >> 5] |= 1u << (i & 31);
+    }
+
+
+    mPointFinder->setCellSize(Parameters::instance.getCellSize());
     
-	if (mTopCritterIndex != -1 && mAgents[mTopCritterIndex].mStatus != eAlive)
+	// (the pool starts out empty, so not even index 0 is there until the first agent is)
+	if (mTopCritterIndex != -1 && (mTopCritterIndex >= mAgents.getCapacity() || mAgents[mTopCritterIndex].mStatus != eAlive))
 		mTopCritterIndex = -1;
 
 	int topCritterIndex = -1;
@@ -254,23 +581,42 @@ int SphereWorld :: step()
 
 	int result = 0;
     int lastLiveAgentIndex = -1;
-    for (int i = 0; i <= mMaxLiveAgentIndex; i++)
-    {
-        Agent & agent = mAgents[i];
 
-        if (agent.mStatus == eAlive)
+    // go through the agents in index order, skipping the empty slots a word of the bitmap at a time. The word is
+    // read again after each step, so an agent spawned further on gets a step this turn, and one killed before
+    // its turn doesn't. (Going through mLiveAgents instead would visit the agents in the order that spawning
+    // and dying has shuffled them into, which changes the outcome of the world, and is slower, as the agents
+    // are then visited out of memory order)
+    for (int word = 0; word < (int) mAwakeSlots.size(); word++)
+    {
+        for (unsigned bits = mAwakeSlots[word]; bits; )
         {
-			if (agent.mEnergy > topEnergy) {
-				topCritterIndex = i;
-				topEnergy = agent.mEnergy;
-			}
-            lastLiveAgentIndex = i;
-            agent.step(this);
-			result += agent.mNumSegments;
+            int bit = lowestBit(bits);
+            int i = (word << 5) + bit;
+
+            Agent & agent = mAgents[i];
+            if (agent.mStatus == eAlive)
+            {
+                if (agent.mEnergy > topEnergy) {
+                    topCritterIndex = i;
+                    topEnergy = agent.mEnergy;
+                }
+                lastLiveAgentIndex = i;
+                mSweepIndex = i;
+                if ((agent.mDormant == 0 && agent.mSleep <= 0 && agent.mCadenceBand == UNTHROTTLED_BAND) || !parkAgent(i)) {
+                    agent.step(this);
+                    result += agent.mNumSegments;
+                }
+            }
+
+            bits = mAwakeSlots[word] & (~1u << bit);
         }
     }
-    
-    mMaxLiveAgentIndex = lastLiveAgentIndex;
+    mSweepIndex = NOT_SWEEPING;
+
+    // the parked agents are still in the world
+    result += mParkedSegments + mSegmentsBehindSweep;
+    mMaxLiveAgentIndex = max(lastLiveAgentIndex, getLastParkedIndex());
 	if (mTopCritterIndex ==-1)
 		mTopCritterIndex = topCritterIndex;
 
@@ -293,177 +639,513 @@ int SphereWorld :: step()
 
 int SphereWorld::getNearbyEntities(SphereEntity * pNearEntity, float distance, SphereEntity **pResultArray, int maxResults /*= 16 */)
 {
-    return spherePointFinder.getNearbyEntities(pNearEntity, distance, pResultArray, maxResults);
+    return mPointFinder->getNearbyEntities(pNearEntity, distance, pResultArray, maxResults);
 }
 
 int SphereWorld::getNearbyEntities(const Vector3 & location, float distance, SphereEntity **pResultArray, int maxResults /* = 16 */)
 {
-    return spherePointFinder.getNearbyEntities(location, distance, pResultArray, maxResults);
+    return mPointFinder->getNearbyEntities(location, distance, pResultArray, maxResults);
 }
 
 int SphereWorld::getNearbyEntities(const Vector3 & location, float distance, SphereEntity **pResultArray, int maxResults /* = 16 */, Agent *pExclude /* = null */)
 {
-    return spherePointFinder.getNearbyEntities(location, distance, pResultArray, maxResults, pExclude);
+    return mPointFinder->getNearbyEntities(location, distance, pResultArray, maxResults, pExclude);
+}
+
+int SphereWorld::countWithin(const Vector3 & location, float distance, int limit, Agent *pExclude /* = null */)
+{
+    return mPointFinder->countWithin(location, distance, limit, pExclude);
+}
+
+bool SphereWorld::anyWithin(const Vector3 & location, float distance, Agent *pExclude /* = null */)
+{
+    return mPointFinder->anyWithin(location, distance, pExclude);
+}
+
+int SphereWorld::findNearest(const Vector3 & location, int k, SphereEntity **pResultArray, float maxDistance, unsigned kindMask,
+                             Agent *pAgent, entityFilter filter)
+{
+    return mPointFinder->findNearest(location, k, pResultArray, maxDistance, kindMask, pAgent, filter);
+}
+
+unsigned SphereWorld::getKindsNear(const Vector3 & location, float distance, unsigned kindMask /* = ALL_ENTITY_KINDS */)
+{
+    return mPointFinder->getKindsNear(location, distance, kindMask);
+}
+
+bool SphereWorld::lookAlongPath(const Vector3 *pLocations, const float *pRadii, int numSteps, Agent *pLooker, facingFunction func,
+                                unsigned targetKinds /* = ALL_ENTITY_KINDS */)
+{
+    return mPointFinder->lookAlongPath(pLocations, pRadii, numSteps, pLooker, func, targetKinds);
 }
 
 void SphereWorld :: registerEntity(SphereEntity *pEntity)
 {
-    spherePointFinder.insert(pEntity);
+    mPointFinder->insert(pEntity);
 }
 
 void SphereWorld :: unregisterEntity(SphereEntity *pEntity)
 {
-    spherePointFinder.remove(pEntity);
+    mPointFinder->remove(pEntity);
 }
 
 void SphereWorld :: moveEntity(SphereEntity *pEntity, Vector3 newLoc)
 {
-    spherePointFinder.moveEntity(pEntity, newLoc);
+    mPointFinder->moveEntity(pEntity, newLoc);
 }
 
-#define TRACE_TEST if(false)TRACE
+/**
+ Switch to a different method of finding nearby entities, re-registering all the existing entities with it
+ **/
+void SphereWorld :: setPointFinder(ePointFinder pointFinder)
+{
+    if (pointFinder == mPointFinderType)
+        return;
+
+    delete mPointFinder;
+    mPointFinder = createPointFinder(pointFinder);
+    mPointFinderType = pointFinder;
+
+    for (int n = 0; n < (int) mLiveAgents.size(); n++)
+    {
+        Agent & agent = mAgents[mLiveAgents[n]];
+        if (agent.mStatus != eNonExistent)
+        {
+            for (int j = 0; j < agent.mNumSegments; j++)
+            {
+                agent.mSegments[j].mInserted = false;
+                registerEntity(&agent.mSegments[j]);
+            }
+        }
+    }
+}
+
+ePointFinder SphereWorld :: getPointFinder()
+{
+    return mPointFinderType;
+}
 
 /**
- Used to test the point finding utility
+ Print how full the point finder's cells are, to judge whether its resolution suits the population
  **/
-void SphereWorld::test()
+void SphereWorld :: printPointFinderStats()
 {
-	return;
-	srand(0);
-    std::vector<SphereEntity*> entities;
-    size_t i;
-	size_t testSize = 1000;
-    SphereEntityPtr results[1000];
+    PointFinderStats stats;
+    mPointFinder->getStats(stats);
+    stats.print();
+}
 
-	//testPt = (0.310198,-0.572352,-0.980855), pEntity->mLocation = (0.296304,-0.528855,-0.997681), distance = 0.043497
-#if 0
-	SphereEntity * pEntity = new SphereEntity();
-    pEntity->mLocation = Vector3(0.296304f,-0.528855f,-0.997681f);
-    registerEntity(pEntity);
+/**
+ Time the queries that Agent::move, Agent::spawnIfAble and addFood make against each kind of point finder, using
+ the entities currently in the world. The move queries are made in agent order, as step() makes them,
+ while the spawn queries are shuffled, so that they mostly miss the cache as scattered spawns do. To
+ count the cache misses themselves, run this under a profiler with MORTON_BUCKET_ORDER on and off.
+ **/
+void SphereWorld :: benchmarkPointFinders()
+{
+    vector<int> liveAgents;
+    for (int n = 0; n < (int) mLiveAgents.size(); n++)
+        if (mAgents[mLiveAgents[n]].mStatus == eAlive)
+            liveAgents.push_back(mLiveAgents[n]);
 
-	Vector3 testPt(0.310198f,-0.572352f,-0.980855f);
+    if (liveAgents.empty())
+        return;
 
-	float distance = calcDistance(testPt, pEntity->mLocation);//.distance(pEntity->mLocation);
+    // pick the spawn points up front, so that every point finder answers the same queries
+    float cellSize = Parameters::instance.getCellSize();
+    vector<int> spawners(liveAgents);
+    for (int i = (int) spawners.size() - 1; i > 0; i--)
+        swap(spawners[i], spawners[UtilsRandom::getRangeRandom(0, i)]);
 
-    int numEntities = getNearbyEntities(testPt, distance, results);
-                
-	if (! numEntities) {
-		throw "blah";
-	}
-#else
+    vector<Vector3> spawnPoints(spawners.size());
+    for (size_t i = 0; i < spawners.size(); i++)
+    {
+        Vector3 pt = mAgents[spawners[i]].mSpawnLocation;
+        pt.x += UtilsRandom::getRangeRandom(-cellSize, cellSize);
+        pt.y += UtilsRandom::getRangeRandom(-cellSize, cellSize);
+        pt.z += UtilsRandom::getRangeRandom(-cellSize, cellSize);
+        pt.normalize();
+        spawnPoints[i] = pt;
+    }
 
+    int numPasses = max(1, 200000 / (int) liveAgents.size());
+    double numQueries = (double) numPasses * liveAgents.size();
+    SphereEntityPtr entities[24];
 
-    for (i = 0; i < testSize; i++)
+    ePointFinder originalPointFinder = mPointFinderType;
+    for (int pointFinder = 0; pointFinder < eNumPointFinders; pointFinder++)
     {
-        Vector3 v(UtilsRandom::getUnitRandom(),UtilsRandom::getUnitRandom(),UtilsRandom::getUnitRandom());
-        
-        SphereEntity * pEntity = new SphereEntity();
-        pEntity->mLocation = v;
-        //registerEntity(pEntity);
-        
-        entities.push_back(pEntity);
+        setPointFinder((ePointFinder) pointFinder);
+        mPointFinder->setCellSize(cellSize);
+
+        long movesFound = 0;
+        clock_t start = clock();
+        for (int pass = 0; pass < numPasses; pass++)
+            for (size_t i = 0; i < liveAgents.size(); i++)
+                movesFound += getNearbyEntities(mAgents[liveAgents[i]].mSegments[0].mLocation, cellSize, entities, 16);
+        double moveTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+        // spawnIfAble only counts its neighbors, up to one more than it tolerates
+        long spawnsFound = 0;
+        start = clock();
+        for (int pass = 0; pass < numPasses; pass++)
+            for (size_t i = 0; i < spawners.size(); i++)
+                spawnsFound += countWithin(spawnPoints[i], cellSize, MAX_CROWDING + 1, &mAgents[spawners[i]]);
+        double spawnTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+        // addFood and die only check whether a spot is free
+        long foodBlocked = 0;
+        start = clock();
+        for (int pass = 0; pass < numPasses; pass++)
+            for (size_t i = 0; i < spawners.size(); i++)
+                foodBlocked += anyWithin(spawnPoints[i], cellSize / 2);
+        double foodTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+        print("point finder %d: move queries %.0f ns (%.2f found), spawn counts %.0f ns (%.2f found), food checks %.0f ns (%.2f blocked)\n",
+            pointFinder, moveTime * 1e9 / numQueries, movesFound / numQueries, spawnTime * 1e9 / numQueries, spawnsFound / numQueries,
+            foodTime * 1e9 / numQueries, foodBlocked / numQueries);
     }
-    
-    for (i = 0; i < entities.size(); i++)
+
+    setPointFinder(originalPointFinder);
+}
+
+static Vector3 randomSpherePoint()
+{
+    Vector3 v(UtilsRandom::getUnitRandom(), UtilsRandom::getUnitRandom(), UtilsRandom::getUnitRandom());
+    v.normalize();
+    return v;
+}
+
+/**
+ Runs a random sequence of inserts, moves, removes and queries against a point finder, checking every query
+ against a brute force search. The agents are only used to tag the entities for the exclusion tests.
+ Prints the first difference and throws.
+ **/
+static void testPointFinder(ePointFinder pointFinderType, Agent *pAgents, int numAgents, int numEntities, int numOperations)
+{
+    BaseSpherePointFinder * pPointFinder = createPointFinder(pointFinderType);
+
+    vector<SphereEntity> entities(numEntities);
+    for (int i = 0; i < numEntities; i++)
     {
-		TRACE_TEST("looking for %d\n", (int)i);
+        entities[i].mLocation = randomSpherePoint();
+        entities[i].mAgent = &pAgents[i % numAgents];
+        entities[i].mType = UtilsRandom::getRangeRandom(eBarrier1, eLastInstruction - 1);
+    }
 
-        SphereEntity * pEntity = entities[i];
-		registerEntity(pEntity);
-		//spherePointFinder.insert(pEntity);
+    vector<SphereEntity*> expected, found(numEntities);
+    vector<float> nearestDistances;
+    const char * failure = NULL;
 
-        for (int j = 0; j < 4; j++)
-        {
-            for (int k = 0; k < 4; k++)
-            {
-		        float d = UtilsRandom::getRangeRandom(0.01f, .1f);
-	    
-				Vector3 testPt = pEntity->mLocation;
-                testPt.x += UtilsRandom::getRangeRandom(-d, d);
-                testPt.y += UtilsRandom::getRangeRandom(-d, d);
-                testPt.z += UtilsRandom::getRangeRandom(-d, d);
-				testPt.normalize();
-
-				float distance = calcDistance(testPt, pEntity->mLocation);//.distance(pEntity->mLocation);
-
-				TRACE_TEST("testPt = (%f,%f,%f), pEntity->mLocation = (%f,%f,%f), distance = %f\n",
-					testPt.x, testPt.y, testPt.z,
-					pEntity->mLocation.x, pEntity->mLocation.y, pEntity->mLocation.z,
-					distance);
-
-				memset(results,0,sizeof(results));
-                int numEntities = getNearbyEntities(testPt, distance, results, testSize);
-                
-                bool foundEntity = false;
-                for (int l = 0; l < numEntities; l++)
-                    if (results[l] == pEntity)
-                    {
-                        foundEntity = true;
-                        break;
-                    }
-                
-                if (! foundEntity)
+    for (int operation = 0; operation < numOperations && failure == NULL; operation++)
+    {
+        SphereEntity & entity = entities[UtilsRandom::getRangeRandom(0, numEntities - 1)];
+
+        switch (UtilsRandom::getRangeRandom(0, 4)) {
+            case 0:
+                if (! entity.mInserted)
+                    pPointFinder->insert(&entity);
+                break;
+
+            case 1:
+                pPointFinder->remove(&entity);
+                break;
+
+            case 2:
+                if (entity.mInserted)
+                {
+                    // mostly small steps, as agents take, with the occasional jump across the world
+                    float step = UtilsRandom::getRangeRandom(1, 20) == 1 ? 1.0f : .02f;
+                    Vector3 newLoc = entity.mLocation + randomSpherePoint() * step;
+                    newLoc.normalize();
+                    pPointFinder->moveEntity(&entity, newLoc);
+                }
+                break;
+
+            case 3:
+                if (UtilsRandom::getRangeRandom(1, 500) == 1)
+                    pPointFinder->setCellSize(UtilsRandom::getRangeRandom(.002f, .05f));
+                break;
+
+            default: {
+                Vector3 pt = randomSpherePoint();
+                float distance = UtilsRandom::getRangeRandom(.001f, .15f);
+                Agent * pExclude = UtilsRandom::getRangeRandom(0, 1) ? &pAgents[UtilsRandom::getRangeRandom(0, numAgents - 1)] : NULL;
+
+                expected.clear();
+                for (int i = 0; i < numEntities; i++)
+                    if (entities[i].mInserted && entities[i].mAgent != pExclude && calcDistance(pt, entities[i].mLocation) <= distance)
+                        expected.push_back(&entities[i]);
+                sort(expected.begin(), expected.end());
+                int numExpected = (int) expected.size();
+
+                // everything in range...
+                int numFound = pPointFinder->getNearbyEntities(pt, distance, &found[0], numEntities, pExclude);
+                sort(found.begin(), found.begin() + numFound);
+                if (numFound != numExpected || ! equal(expected.begin(), expected.end(), found.begin()))
                 {
-					HEAPCHECK;
+                    failure = "getNearbyEntities";
+                    break;
+                }
 
-					unregisterEntity(pEntity);
-                    registerEntity(pEntity);
-                    getNearbyEntities(testPt, distance, results, testSize);
-                    throw "fail";
+                // ...a limited number of them...
+                int maxResults = UtilsRandom::getRangeRandom(1, 8);
+                numFound = pPointFinder->getNearbyEntities(pt, distance, &found[0], maxResults, pExclude);
+                if (numFound != min(maxResults, numExpected))
+                {
+                    failure = "limited getNearbyEntities";
+                    break;
                 }
+                for (int i = 0; i < numFound; i++)
+                    if (! binary_search(expected.begin(), expected.end(), found[i]))
+                        failure = "limited getNearbyEntities";
+
+                // ...and the queries that don't gather them
+                int limit = UtilsRandom::getRangeRandom(0, 8);
+                if (pPointFinder->countWithin(pt, distance, limit, pExclude) != min(limit, numExpected))
+                    failure = "countWithin";
+                else if (pPointFinder->anyWithin(pt, distance, pExclude) != (numExpected > 0))
+                    failure = "anyWithin";
+                if (failure)
+                    break;
+
+                // ...and the nearest few of a kind, which may be further away
+                int k = UtilsRandom::getRangeRandom(1, 8);
+                float maxDistance = UtilsRandom::getRangeRandom(0, 1) ? distance : 2;
+                unsigned kindMask = UtilsRandom::getRangeRandom(0, 1) ? ANY_ENTITY_KIND : ENTITY_KIND_BIT(UtilsRandom::getRangeRandom(0, eNumEntityKinds));
+
+                nearestDistances.clear();
+                for (int i = 0; i < numEntities; i++)
+                    if (entities[i].mInserted && calcDistance(pt, entities[i].mLocation) <= maxDistance && passesFilter(&entities[i], kindMask, pExclude, NULL))
+                        nearestDistances.push_back(calcDistance(pt, entities[i].mLocation));
+                sort(nearestDistances.begin(), nearestDistances.end());
+
+                numFound = pPointFinder->findNearest(pt, k, &found[0], maxDistance, kindMask, pExclude);
+                if (numFound != min(k, (int) nearestDistances.size()))
+                    failure = "findNearest";
+                for (int i = 0; i < numFound; i++)
+                    if (calcDistance(pt, found[i]->mLocation) != nearestDistances[i] || ! passesFilter(found[i], kindMask, pExclude, NULL))
+                        failure = "findNearest";
+                break; }
+        }
+
+        if (failure)
+            print("point finder %d failed %s after %d operations\n", (int) pointFinderType, failure, operation);
+    }
+
+    delete pPointFinder;
+
+    if (failure)
+        throw "fail";
+}
+
+/**
+ Checks that a world allowed more than MAX_AGENTS agents grows to hold them, and raises its segment limits to match
+ **/
+static void testGrowth()
+{
+    SphereWorld * pWorld = new SphereWorld();
+    pWorld->setMaxAgents(MAX_AGENTS * 2);
+
+    const char *failure = NULL;
+    char genome[] = {eInstructionPhotosynthesize, 0};
+    int numAgents = MAX_AGENTS + MAX_AGENTS / 2;
+    for (int i = 0; i < numAgents && ! failure; i++)
+    {
+        Agent *pAgent = pWorld->createEmptyAgent();
+        if (pAgent == NULL)
+            failure = "createEmptyAgent";
+        else {
+            pAgent->initialize(randomSpherePoint(), genome, false);
+            pWorld->addAgentToWorld(pAgent);
+        }
+    }
+
+    // (some might spawn, but none should be turned away)
+    if (! failure) {
+        pWorld->step();
+        if (pWorld->getNumAgents() < numAgents)
+            failure = "step";
+        else if (pWorld->getKillSegmentThreshold() <= KILL_SEGMENT_THRESHHOLD || pWorld->getMaxTotalSegments() <= MAX_TOTAL_SEGMENTS)
+            failure = "segment limits";
+    }
+    delete pWorld;
+
+    if (failure) {
+        print("world growth failed %s\n", failure);
+        throw "fail";
+    }
+}
+
+/**
+ Used to test the point finding utilities: each kind of point finder is checked against a brute force search.
+ Also checks that a world can grow past MAX_AGENTS
+ **/
+void SphereWorld::test()
+{
+    // (the agents of a chunk are together, and only the first few are used)
+    if (mAgents.getCapacity() == 0)
+        growAgents();
+    for (int pointFinder = 0; pointFinder < eNumPointFinders; pointFinder++)
+        testPointFinder((ePointFinder) pointFinder, &mAgents[0], 10, 1000, 5000);
+    testGrowth();
+}
+
+/**
+ Measure how the point finders scale: each kind is filled with 1k, 20k and 300k random entities, then timed
+ moving them and answering queries of a range of sizes. Unlike benchmarkPointFinders(), this doesn't depend
+ on what's in the world, so the numbers can be compared between runs and between finder designs.
+ **/
+void SphereWorld :: benchmarkPointFinderScaling()
+{
+    const int sizes[] = { 1000, 20000, 300000 };
+    const float radii[] = { .005f, .01f, .03f, .1f };
+    const int numQueries = 100000;
+    const int numQueryPoints = 4096;
+
+    vector<Vector3> queryPoints(numQueryPoints);
+    for (int i = 0; i < numQueryPoints; i++)
+        queryPoints[i] = randomSpherePoint();
+
+    SphereEntityPtr results[16];
+
+    for (size_t size = 0; size < sizeof(sizes)/sizeof(sizes[0]); size++)
+    {
+        int numEntities = sizes[size];
+        vector<Vector3> locations(numEntities), moves(numEntities);
+        for (int i = 0; i < numEntities; i++)
+        {
+            locations[i] = randomSpherePoint();
+            moves[i] = locations[i] + randomSpherePoint() * Parameters::instance.getCellSize();
+            moves[i].normalize();
+        }
+
+        for (int pointFinder = 0; pointFinder < eNumPointFinders; pointFinder++)
+        {
+            BaseSpherePointFinder * pPointFinder = createPointFinder((ePointFinder) pointFinder);
+            pPointFinder->setCellSize(Parameters::instance.getCellSize());
+
+            vector<SphereEntity> entities(numEntities);
+            clock_t start = clock();
+            for (int i = 0; i < numEntities; i++)
+            {
+                entities[i].mLocation = locations[i];
+                pPointFinder->insert(&entities[i]);
+            }
+            double insertTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+            start = clock();
+            for (int i = 0; i < numEntities; i++)
+                pPointFinder->moveEntity(&entities[i], moves[i]);
+            double moveTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+            print("point finder %d, %d entities: %.0f ns per insert, %.0f ns per move\n", pointFinder, numEntities,
+                insertTime * 1e9 / numEntities, moveTime * 1e9 / numEntities);
+
+            for (size_t radius = 0; radius < sizeof(radii)/sizeof(radii[0]); radius++)
+            {
+                long numFound = 0;
+                start = clock();
+                for (int i = 0; i < numQueries; i++)
+                    numFound += pPointFinder->getNearbyEntities(queryPoints[i % numQueryPoints], radii[radius], results, 16);
+                double queryTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+                long numCounted = 0;
+                start = clock();
+                for (int i = 0; i < numQueries; i++)
+                    numCounted += pPointFinder->countWithin(queryPoints[i % numQueryPoints], radii[radius], MAX_CROWDING + 1);
+                double countTime = double(clock() - start) / CLOCKS_PER_SEC;
+
+                print("    distance %.3f: %.0f ns per query (%.2f found), %.0f ns per count (%.2f counted)\n", radii[radius],
+                    queryTime * 1e9 / numQueries, double(numFound) / numQueries, countTime * 1e9 / numQueries, double(numCounted) / numQueries);
             }
+
+            delete pPointFinder;
         }
-		unregisterEntity(pEntity);
     }
-    
-    //for (i = 0; i < entities.size(); i++)
-    //    unregisterEntity(entities[i]);
-#endif
 }
 
 
 void SphereWorld :: killAtLeastNumSegments(int toKill, int excludingAgent) {
-    while (toKill > 0) {
+    // (stopping once there's nothing left to pick, such as when the excluded agent is the only one alive)
+    int numToPick = 0;
+    for (int n = 0; n < (int) mLiveAgents.size(); n++)
+        if (mLiveAgents[n] != excludingAgent && mAgents[mLiveAgents[n]].mStatus == eAlive)
+            ++numToPick;
+
+    while (toKill > 0 && numToPick > 0) {
         
-        int i = UtilsRandom::getRangeRandom(0, getMaxLiveAgentIndex());
+        int i = mLiveAgents[UtilsRandom::getRangeRandom(0, (int) mLiveAgents.size() - 1)];
         if (i == excludingAgent) continue;
         Agent & agent = getAgent(i);
         if (agent.mStatus == eAlive) {
             toKill -= agent.mNumSegments;
             killAgent(i);
+            --numToPick;
         }
     }
 }
 
-void SphereWorld::read(istream & in)
+void SphereWorld::read(istream & in, int version /* = WORLD_SAVE_VERSION */)
 {
-	spherePointFinder.clear();
+	mPointFinder->clear();
 	mTopSpecies.clear();
+	mTopCritterIndex = -1;
+	
+	// version 1 saves have every one of MAX_AGENTS agents, followed by MAX_SEGMENTS segments for each of them.
+	// Later ones have only the agents up to the last one in the world, each followed by its own segments
+	int numSlots = MAX_AGENTS;
+	if (version >= 2) {
+		readBinary(mMaxAgents, in);
+		readBinary(numSlots, in);
+	}
+	while (mAgents.getCapacity() < numSlots)
+		growAgents();
 	
-	in.read((char*)&mAgents,sizeof(mAgents));
-	in.read((char*)&mEntites,sizeof(mEntites));
+	// (every agent is replaced, so all of the segments are let go of at once)
+	mSegmentArena.clear();
+	for (int i = 0; i < mAgents.getCapacity(); i++)
+	{
+		Agent & agent = mAgents[i];
+		if (i >= numSlots)
+			agent.mStatus = eNonExistent;
+		else
+			in.read((char*)&agent, sizeof(Agent));
+		agent.mSegments = &mNoSegments;
+		if (agent.mStatus != eNonExistent) {
+			allocateSegments(i, agent.mNumSegments);
+			if (version >= 2)
+				in.read((char*)agent.mSegments, agent.mNumSegments * sizeof(SphereEntity));
+		}
+	}
+	if (version < 2) {
+		SphereEntity segments[MAX_SEGMENTS];
+		for (int i = 0; i < numSlots; i++) {
+			Agent & agent = mAgents[i];
+			in.read((char*)segments, MAX_SEGMENTS * sizeof(SphereEntity));
+			if (agent.mStatus != eNonExistent) {
+				for (int j = 0; j < agent.mNumSegments; j++)
+					agent.mSegments[j] = segments[j];
+			}
+		}
+	}
 
-#if LL_FREE_SLOTS
-#else
-	mFreeSlots.empty();
-#endif
 	mNumAgents = mMaxLiveAgentIndex = 0;
+	mSpecies.clear();
+	mPrograms.clear();
+	mPhylogeny.clear();
+	mCountedSlots.assign(mCountedSlots.size(), 0);
 
-	for (int i = 0; i < MAX_AGENTS; i++)
+	for (int i = 0; i < mAgents.getCapacity(); i++)
 	{
 		Agent & agent = mAgents[i];
-		agent.mSegments = &this->mEntites[i*MAX_SEGMENTS];
-		for (int j = 0; j < MAX_SEGMENTS; j++)
-			agent.mSegments[j].mAgent = &agent;
-
-		if (agent.mStatus == eNonExistent) {
-#if LL_FREE_SLOTS
-#else
-			mFreeSlots.insert(i);
-#endif
-		}
-		else {
+		mAgentSpecies[i] = mAgentProgram[i] = -1;
+
+		if (agent.mStatus != eNonExistent) {
 			++mNumAgents;
+			agent.updateCadenceBand();
+			setAgentGenome(i, agent.mGenome);
+			updateSpeciesCount(i);
 
 			if (agent.mStatus == eAlive) {
 				mMaxLiveAgentIndex = i;
@@ -474,152 +1156,149 @@ void SphereWorld::read(istream & in)
 				SphereEntity & entity = agent.mSegments[j];
 				entity.mSphereNext = NULL;
 				entity.mSpherePrev = NULL;
+				entity.mAgent = &agent;
 				entity.mWorld = this;
 				entity.mSpherePoint.x = -9999; // force registration
 				registerEntity(&entity);
 			}
 		}
 	}
-    readMap(mChildToParentGenomes, in);
-    readMap(mGenomeToFirstTurn, in);
+	rebuildSlotLists();
 	
-}
+    map<string,string> childToParentGenomes;
+    map<string,long> genomeToFirstTurn;
+    readMap(childToParentGenomes, in);
+    readMap(genomeToFirstTurn, in);
+	
+    // (older saves have an entry for the empty genome, the parent of the genomes without one. They also
+    // have the first turn of every genome there has ever been, but only those still in use are kept)
+    for (map<string,string>::iterator i = childToParentGenomes.begin(); i != childToParentGenomes.end(); i++) {
+        if (i->first.length() > 0)
+            mPhylogeny.link(mSpecies.intern(i->first.c_str()), i->second.length() > 0 ? mSpecies.intern(i->second.c_str()) : NO_PARENT);
+    }
 
-std::map<std::string, std::string> mChildToParentGenomes;
-std::map<std::string, long> mGenomeToFirstTurn;
+    // (and older saves still have the lineages that have died out, which go now)
+    mNumPruned += mPhylogeny.removeDeadLinks(mReleasedSpecies);
+    for (size_t i = 0; i < mReleasedSpecies.size(); i++)
+        removeSpeciesIfUnused(mReleasedSpecies[i]);
+    mReleasedSpecies.clear();
+
+    for (map<string,long>::iterator i = genomeToFirstTurn.begin(); i != genomeToFirstTurn.end(); i++) {
+        int species = i->first.length() > 0 ? mSpecies.find(i->first.c_str()) : -1;
+        if (species != -1)
+            mPhylogeny.setFirstTurn(species, i->second);
+    }
+}
 
 
 void SphereWorld::write(ostream & out)
 {
-    pruneTree();
+    // (they stay parked, but they're saved as they would be if they'd been stepped)
+    for (int word = 0; word < (int) mParkedSlots.size(); word++) {
+        for (unsigned bits = mParkedSlots[word]; bits; bits &= bits - 1)
+            settleAgent((word << 5) + lowestBit(bits), mCurrentTurn);
+    }
 
-    out.write((char*)&mAgents,sizeof(mAgents));
-	out.write((char*)&mEntites,sizeof(mEntites));
-    writeMap(mChildToParentGenomes, out);
-    writeMap(mGenomeToFirstTurn, out);
+    // (the agents past the last one in the world are left out)
+    int numSlots = 0;
+    for (int n = 0; n < (int) mLiveAgents.size(); n++)
+        numSlots = max(numSlots, mLiveAgents[n] + 1);
+    writeBinary(mMaxAgents, out);
+    writeBinary(numSlots, out);
+    
+    for (int i = 0; i < numSlots; i++) {
+        Agent & agent = mAgents[i];
+        out.write((char*)&agent, sizeof(Agent));
+        if (agent.mStatus != eNonExistent)
+            out.write((char*)agent.mSegments, agent.mNumSegments * sizeof(SphereEntity));
+    }
+    
+    // (saved as maps of genomes, as they always have been)
+    map<string,string> childToParentGenomes;
+    map<string,long> genomeToFirstTurn;
+    for (int species = 0; species < mPhylogeny.getNumSpecies(); species++) {
+        if (mPhylogeny.isInTree(species)) {
+            int parentSpecies = mPhylogeny.getParent(species);
+            childToParentGenomes[string(mSpecies.getGenome(species))] = parentSpecies == NO_PARENT ? string() : string(mSpecies.getGenome(parentSpecies));
+        }
+        if (mPhylogeny.hasFirstTurn(species))
+            genomeToFirstTurn[string(mSpecies.getGenome(species))] = mPhylogeny.getFirstTurn(species);
+    }
+    writeMap(childToParentGenomes, out);
+    writeMap(genomeToFirstTurn, out);
 }
 
 void SphereWorld::registerMutation(const char * newGenome, const char * parentGenome)
 {
-    std::string genome(newGenome);
-    map<string,string>::iterator it = mChildToParentGenomes.find(genome);
-    if (it == mChildToParentGenomes.end()) {
-        
-        for (it = mChildToParentGenomes.begin(); it != mChildToParentGenomes.end(); it++)
-            if (it->second == newGenome)
-                return;
-        
-        mChildToParentGenomes[genome] = parentGenome;
-        mGenomeToFirstTurn[genome] = mCurrentTurn;
-    }
+    int species = mSpecies.intern(newGenome);
+    registerMutation(species, mSpecies.intern(parentGenome));
+}
+
+void SphereWorld::registerMutation(int species, int parentSpecies)
+{
+    mPhylogeny.registerMutation(species, parentSpecies, mCurrentTurn);
 }
 
 std::string SphereWorld::getParentGenome(const char * pGenome)
 {
-    string genome(pGenome);
-    map<string,string>::iterator it = mChildToParentGenomes.find(genome);
-    if (it == mChildToParentGenomes.end())
+    int species = mSpecies.find(pGenome);
+    int parentSpecies = species == -1 ? NO_PARENT : mPhylogeny.getParent(species);
+    if (parentSpecies == NO_PARENT)
         return "";
     else
-        return it->second;
+        return string(mSpecies.getGenome(parentSpecies));
 }
 
 bool SphereWorld::hasChildGenomes(const char *genome)
 {
-	for (map<string,string>::iterator i = mChildToParentGenomes.begin(); i != mChildToParentGenomes.end(); i++) {
-		if (i->second == genome) {
-			return true;
-		}
-	}
-	
-	return false;
+    int species = mSpecies.find(genome);
+	return species != -1 && mPhylogeny.hasChildren(species);
 }
 
 long SphereWorld::getFirstTurn(const char * pGenome)
 {
-    string genome(pGenome);
-    map<string, long>::iterator it = mGenomeToFirstTurn.find(genome);
-    if (it == mGenomeToFirstTurn.end())
+    int species = mSpecies.find(pGenome);
+    if (species == -1)
         return 0;
     else
-        return it->second;
-}
-
-static bool compareTopSpeciesFunc(const pair<string,int> &p1, const pair<string,int> &p2);
-static bool compareTopSpeciesFunc(const pair<string,int> &p1, const pair<string,int> &p2)
-{
-    return p1.second > p2.second;
+        return mPhylogeny.getFirstTurn(species);
 }
 
+/**
+ Copies out the species with the most living agents, most first. The counts are kept up to date as
+ agents are born and die (see updateSpeciesCount()), already in order, so there's nothing to count here
+ **/
 void SphereWorld::sampleTopSpecies()
 {
-    map<string, int> mapSpeciesToCount;
-    pruneTree(mapSpeciesToCount);
-    
     mTopSpecies.clear();
 
-    for (map<string, int>::iterator i = mapSpeciesToCount.begin(); i != mapSpeciesToCount.end(); i++)
-        mTopSpecies.push_back(*i);
-    
-    sort(mTopSpecies.begin(), mTopSpecies.end(), compareTopSpeciesFunc);
-}
+    int numLivingSpecies = mSpecies.getNumLivingSpecies();
+    for (int rank = 0; rank < numLivingSpecies; rank++) {
+        int species = mSpecies.getSpeciesByRank(rank);
+        mTopSpecies.push_back(make_pair(string(mSpecies.getGenome(species)), mSpecies.getCount(species)));
+    }
     
-void SphereWorld :: pruneTree() {
-    map<string, int> mapSpeciesToCount;
-    pruneTree(mapSpeciesToCount);
+    // (the family tree is pruned as the species die out, see pruneExtinctLineage())
+    if (mNumPruned != mNumPrunedAtSample) {
+        printf("---- total pruned count = %d\n", mNumPruned);
+        mNumPrunedAtSample = mNumPruned;
+    }
 }
 
-static int pruned = 0;
-
-void SphereWorld::pruneTree(map<string, int> & mapSpeciesToCount) {
-	
-    // first collect all living genomes
+std::set<std::string> & SphereWorld::getLivingGenomes()
+{
     mLivingGenomes.clear();
-    set<string> unprunableGenomes;
-    
-    for (int i = 0; i <= mMaxLiveAgentIndex; i++)
-    {
-        Agent & agent = mAgents[i];
-        
-        if (agent.mStatus == eAlive && agent.mSleep != -1) {
-            string genome (agent.mGenome);
-            mLivingGenomes.insert(genome);
-            
-            int count = mapSpeciesToCount[genome];
-            ++count;
-            mapSpeciesToCount[genome] = count;
-            
-            string unprunableGenome = genome;
-            while (unprunableGenomes.find(unprunableGenome) == unprunableGenomes.end()) {
-                unprunableGenomes.insert(unprunableGenome);
-                unprunableGenome = mChildToParentGenomes[unprunableGenome];
-            }
-        }
-    }
-
-    std::list<std::string> listErase;
-    for (map<string,string>::iterator i = mChildToParentGenomes.begin(); i != mChildToParentGenomes.end(); i++) {
-        if (unprunableGenomes.find(i->first) == unprunableGenomes.end() && unprunableGenomes.find(i->second) == unprunableGenomes.end()) {
-            listErase.push_back(i->first);
-        }
-    }
-    
-	for (std::list<std::string>::iterator i = listErase.begin(); i != listErase.end(); i++) {
-        mChildToParentGenomes.erase(*i);
-        ++pruned;
-    }
-	
-    if (listErase.size() > 0)
-        printf("---- total pruned count = %d\n", pruned);
+    int numLivingSpecies = mSpecies.getNumLivingSpecies();
+    for (int rank = 0; rank < numLivingSpecies; rank++)
+        mLivingGenomes.insert(string(mSpecies.getGenome(mSpecies.getSpeciesByRank(rank))));
+    return mLivingGenomes;
 }
 
 void SphereWorld :: addFood(Vector3 point, bool canSprout /*= true */, float energy /* = 0 */, bool allowMutation /* = false */, bool fromAbove /* = false */)
 {
     allowMutation = true;
     float distance = Parameters::instance.getCellSize() / 2;
-    SphereEntityPtr entities[5];
-    int nearbyResults = getNearbyEntities(point, distance, entities, sizeof(entities)/sizeof(entities[0]));
-    if (nearbyResults > 0)
+    if (anyWithin(point, distance))
         return;
     
     Agent *pNewAgent = createEmptyAgent();
@@ -640,6 +1319,7 @@ void SphereWorld :: addFood(Vector3 point, bool canSprout /*= true */, float ene
         pNewAgent->mEnergy = energy;
         pNewAgent->mDormant = canSprout ? Parameters::instance.deadCellDormancy : -1;
         pNewAgent->mSleep = -1;
+        updateSpeciesCount(pNewAgent->mIndex);
         if (fromAbove) {
             pNewAgent->mSegments[0].mScale = 2.0f;
         }
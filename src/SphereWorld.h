@@ -15,44 +15,103 @@
 #include <fstream>
 #include "Constants.h"
 #include "Agent.h"
+#include "AgentPool.h"
+#include "SegmentArena.h"
+#include "AgentScheduler.h"
+#include "GenomeProgram.h"
+#include "SpeciesTable.h"
+#include "Phylogeny.h"
 
 using namespace gameplay;
 using namespace std;
 
-#define LL_FREE_SLOTS 1
+// the method used to find nearby entities
+enum ePointFinder {
+    ePointFinderLinkedList,
+    ePointFinderCellSorted,
+
+    eNumPointFinders
+};
+
+// (the cell-sorted finder lists the neighbours in another order, and so keeps a different few of them when there
+// are more than asked for, which changes how a world evolves)
+#define DEFAULT_POINT_FINDER ePointFinderLinkedList
+
+class BaseSpherePointFinder;
+
+// the version of the saves that write() makes. Version 1 saves, which held MAX_AGENTS agents whether they
+// existed or not, can still be read. (Version 3 saves only differ in the parameters saved ahead of the world)
+#define WORLD_SAVE_VERSION 3
 
 class SphereWorld
 {
 public:
    
     SphereWorld();
+    ~SphereWorld();
 
 	void clear();
     
     int requestFreeAgentSlot();
     void reserveAgentCount(int numAgents);
     Agent * createEmptyAgent(bool killIfNecessary = false);
-    void addAgentToWorld(Agent *);
+    void addAgentToWorld(Agent *, eStatus status = eAlive);
     void killAgent(int agentIndex);
+    void wakeAgent(int agentIndex);
+    void catchUpAgent(int agentIndex);
+    GenomeProgram & setAgentGenome(int agentIndex, const char *pGenome);
+    void allocateSegments(int agentIndex, int numSegments);
+    GenomeProgram & getProgram(int agentIndex) { return mPrograms.get(mAgentProgram[agentIndex]); }
+
+    int getSpecies(int agentIndex) { return mAgentSpecies[agentIndex]; }
+    void updateSpeciesCount(int agentIndex);
+    int internSpecies(const char *pGenome) { return mSpecies.intern(pGenome); }
+    const Genome & getSpeciesGenome(int species) { return mSpecies.getGenome(species); }
+    void rebuildSlotLists();
 	void killAtLeastNumSegments(int minSegments, int excludingAgent = -1);
     
     int step();
 	int getTopCritterIndex() { return mAllowFollow ? mTopCritterIndex : -1; }
 	int	getNumAgents() { return mNumAgents; }
 	int getMaxLiveAgentIndex() { return mMaxLiveAgentIndex; }
+
+    // the most agents the world can hold (MAX_AGENTS unless set otherwise), and the numbers of segments at
+    // which it gets thinned out, which scale with it
+    void setMaxAgents(int maxAgents) { mMaxAgents = maxAgents > 0 ? maxAgents : 1; }
+    int getMaxAgents() { return mMaxAgents; }
+    int getKillSegmentThreshold() { return (int) ((double) KILL_SEGMENT_THRESHHOLD * mMaxAgents / MAX_AGENTS); }
+    int getMaxTotalSegments() { return (int) ((double) MAX_TOTAL_SEGMENTS * mMaxAgents / MAX_AGENTS); }
+
+    // the agents in the world (alive or inanimate), in no particular order
+    int getNumLiveAgents() { return (int) mLiveAgents.size(); }
+    int getLiveAgentIndex(int n) { return mLiveAgents[n]; }
+
     int getNearbyEntities(SphereEntity * pNearEntity, float distance, SphereEntity **pResultArray, int maxResults = 16);
     int getNearbyEntities(const Vector3 & location, float distance, SphereEntity **pResultArray, int maxResults = 16);
     int getNearbyEntities(const Vector3 & location, float distance, SphereEntity **pResultArray, int maxResults, Agent *pExclude);
+    int countWithin(const Vector3 & location, float distance, int limit, Agent *pExclude = NULL);
+    bool anyWithin(const Vector3 & location, float distance, Agent *pExclude = NULL);
+    unsigned getKindsNear(const Vector3 & location, float distance, unsigned kindMask = ALL_ENTITY_KINDS);
+    int findNearest(const Vector3 & location, int k, SphereEntity **pResultArray, float maxDistance = 2, unsigned kindMask = ANY_ENTITY_KIND,
+                    Agent *pAgent = NULL, entityFilter filter = NULL);
+    bool lookAlongPath(const Vector3 *pLocations, const float *pRadii, int numSteps, Agent *pLooker, facingFunction func,
+                       unsigned targetKinds = ALL_ENTITY_KINDS);
 	
 	Agent & getAgent(int i) { return mAgents[i]; }
 
     void registerEntity(SphereEntity *);
     void unregisterEntity(SphereEntity *);
     void moveEntity(SphereEntity *, Vector3);
+
+    void setPointFinder(ePointFinder pointFinder);
+    ePointFinder getPointFinder();
+    void printPointFinderStats();
+    void benchmarkPointFinders();
+    void benchmarkPointFinderScaling();
     
     void test();
         
-	void read(istream &);
+	void read(istream &, int version = WORLD_SAVE_VERSION);
 	void write(ostream &);
 
 	void setAllowFollow(bool allowFollow) { mAllowFollow = allowFollow; mTopCritterIndex = -1;}
@@ -61,27 +120,23 @@ public:
     void addFood(Vector3 point, bool canSprout = true, float energy = 0, bool allowMutation = false, bool fromAbove = false);
 
     void registerMutation(const char * newGenome, const char * parentGenome);
+    void registerMutation(int species, int parentSpecies);
+    void removeSpeciesIfUnused(int species);
     std::string getParentGenome(const char * genome);
     long getFirstTurn(const char * genome);
     std::vector<std::pair<std::string,int> > & getTopSpecies() { return mTopSpecies; }
 	bool hasChildGenomes(const char *genome);
-    std::set<std::string> & getLivingGenomes() { return mLivingGenomes; }
+    std::set<std::string> & getLivingGenomes();
     void sampleTopSpecies();
     
-    void pruneTree(map<string, int> & mapSpeciesToCount);
-    void pruneTree();
-    
 public:
-    Agent mAgents[MAX_AGENTS];
-    SphereEntity mEntites[MAX_AGENTS*MAX_SEGMENTS];
+    AgentPool mAgents;
     int mMaxLiveAgentIndex;
     int mNumAgents;
 	int mNumSegments;
 	int mTopCritterIndex;
 	bool mAllowFollow;
     long mCurrentTurn;
-    std::map<std::string, std::string> mChildToParentGenomes;
-    std::map<std::string, long> mGenomeToFirstTurn;
     std::map<std::string, int> mMapSpeciesToCount;
     std::set<std::string> mLivingGenomes;
 
@@ -89,11 +144,81 @@ public:
     
     
 private:
-#if LL_FREE_SLOTS
-	SphereEntity * mFreeHead;
-#else
-    std::set<int> mFreeSlots;
-#endif
+    // each world has its own point finder, so several worlds can step at once on separate threads
+    BaseSpherePointFinder * mPointFinder;
+    ePointFinder mPointFinderType;
+    int mNumPruned;
+    int mNumPrunedAtSample;
+
+    // the agents' segments point into mSegmentArena, so worlds can't be copied
+    SphereWorld(const SphereWorld &);
+    SphereWorld & operator=(const SphereWorld &);
+
+    int mMaxAgents;
+
+    // a bit per agent slot, set while the slot is free, and a bit per word of those, set while the word is
+    // non zero, so the lowest free slot can be found without scanning the agents. Like all of the arrays
+    // indexed by agent, these grow with mAgents (see growAgents())
+    std::vector<unsigned> mFreeSlots;
+    std::vector<unsigned> mFreeSlotWords;
+
+    inline void setSlotFree(int index) {
+        mFreeSlots[index >> 5] |= 1u << (index & 31);
+        mFreeSlotWords[index >> 10] |= 1u << ((index >> 5) & 31);
+    }
+
+    // the indices of the agents in the world, and where each agent is in that list (or -1)
+    std::vector<int> mLiveAgents;
+    std::vector<int> mLivePosition;
+
+    // a bit per agent that is set while it is in the list and not parked, which step() goes through instead,
+    // to keep to index order, and a bit per agent that is set while it is parked
+    std::vector<unsigned> mAwakeSlots;
+    std::vector<unsigned> mParkedSlots;
+
+    // an agent with nothing to do for a while is parked in mScheduler until the turn it wakes, rather than
+    // being stepped every turn just to count down. mSettledTurn is the last turn its state has been brought up to
+    AgentScheduler mScheduler;
+    std::vector<int> mDueAgents;
+    std::vector<long> mSettledTurn;
+    int mParkedSegments;
+
+    // the parameters that a sleeping step depends on, as they were when the parked agents were parked
+    int mParkedSpeed;
+    float mParkedPhotosynthesizeBonus;
+
+    // the agent that step() is on (-1 before the first, NOT_SWEEPING outside of step()), and the segments of
+    // the parked agents behind it that have been woken or killed this turn
+    int mSweepIndex;
+    int mSegmentsBehindSweep;
+
+    // the genomes in use, the species of each agent (or -1), and a bit per agent that is set while it's
+    // counted in its species' count (see updateSpeciesCount())
+    SpeciesTable mSpecies;
+    std::vector<int> mAgentSpecies;
+    std::vector<unsigned> mCountedSlots;
+
+    // the family tree of the living species, and the species it let go of when a lineage last died out
+    Phylogeny mPhylogeny;
+    std::vector<int> mReleasedSpecies;
+
+    // the compiled genomes of the agents, and the index of each agent's program (or -1)
+    GenomePrograms mPrograms;
+    std::vector<int> mAgentProgram;
+
+    // the segments of the agents, and what an agent without any points to instead (which only knows its world)
+    SegmentArena mSegmentArena;
+    SphereEntity mNoSegments;
+
+    void growAgents();
+    void releaseSegments(int agentIndex);
+    void removeLiveAgent(int index);
+    bool parkAgent(int index);
+    void unparkAgent(int index);
+    void settleAgent(int index, long throughTurn);
+    void wakeParkedAgents();
+    int getLastParkedIndex();
+    void pruneExtinctLineage(int species);
 };
 
 #endif
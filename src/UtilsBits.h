@@ -0,0 +1,26 @@
+//
+//  UtilsBits.h
+//  MutationPlanet
+//
+//
+
+#ifndef MutationPlanet_UtilsBits_h
+#define MutationPlanet_UtilsBits_h
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+// the index of the lowest set bit in mask, which mustn't be 0
+static inline int lowestBit(unsigned mask)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return (int) i;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#endif
@@ -26,9 +26,26 @@
 #include "UtilsRandom.h"
 #include <stdlib.h>
 
+// each thread has its own generator, so that worlds stepping on separate threads neither contend
+// for rand()'s lock nor perturb each other's sequences
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+static THREAD_LOCAL unsigned long long randomState = 1;
+
+void UtilsRandom :: seed(unsigned int seed)
+{
+    randomState = seed;
+}
+
 int UtilsRandom :: getRandom()
 {
-    return rand();
+    // a 64 bit linear congruential generator. The low bits have short periods, so use the high ones
+    randomState = randomState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return int((randomState >> 33) % ((unsigned long long) RAND_MAX + 1));
 }
 
 float UtilsRandom :: getUnitRandom()
@@ -42,7 +59,7 @@ int UtilsRandom :: getRangeRandom(int minVal, int maxVal)
     if (minVal >= maxVal)
         return minVal;
     
-    return minVal + rand() % (maxVal - minVal + 1);
+    return minVal + getRandom() % (maxVal - minVal + 1);
 }
 
 float UtilsRandom :: getRangeRandom(float minVal, float maxVal)
@@ -12,6 +12,9 @@
 class UtilsRandom
 {
 public:
+    // seeds the calling thread's generator
+    static void seed(unsigned int seed);
+
     static int getRandom();
     static float getUnitRandom();
     static int getRangeRandom(int minVal, int maxVal);